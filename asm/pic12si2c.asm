@@ -338,6 +338,9 @@ i2caddram       equ     H'49'
 ledelay         equ     H'4A'
 ledfreq         equ     H'4B'
 
+; start address in data memory for the next read transfer
+i2ctxptr        equ     H'4C'
+
 ; temporary files
 w_temp          equ     H'54'    ; temperorary W storage in interrupt service
 status_temp     equ     H'55'    ; temperorary storage in interrupt service
@@ -462,7 +465,7 @@ sclhigh         btfsc   GPIO, SCL          ; wait until SCL=0    1-2 us
                 goto    breceive           ;                      2 us
 
 ; transmit bytes from tx buffer here
-                movlw   i2ctx1             ; intialize FSR
+                movf    i2ctxptr, W        ; intialize FSR
                 movwf   FSR                ; 
  
 txloop          movf    INDF, W            ; copy byte from tx buffer
@@ -718,6 +721,10 @@ wdtreset        movlw   ini_TRISIO
                 clrf    i2crec2
                 clrf    i2crec3
 
+; read transfers start from tx buffer
+                movlw   i2ctx1
+                movwf   i2ctxptr
+
 ; test data to i2ctx1
                 movlw   H'C5'
                 movwf   i2ctx1 
@@ -986,6 +993,8 @@ cmpdone         movf    CMCON, W         ; clear comparator change flag
                 goto    loop
 
 i2cmd           bcf     i2cstate, I2DATA
+                movlw   i2ctx1             ; next read from tx buffer
+                movwf   i2ctxptr
 
 ; command 0x01 copy data memory byte at given address to transmit buffer
                 movf    i2crec1, W
@@ -1066,13 +1075,50 @@ cmd5            movf    i2crec1, W
 cmd6            movf    i2crec1, W
                 sublw   H'06'              
                 btfss   STATUS, Z
-                goto    cmd7
+                goto    cmd6a
                 movf    i2crec2, W
                 sublw   H'C5'
                 btfss   STATUS, Z
                 goto    loop
                 goto    setup
 
+; command 0x07 next read transfer streams data memory from given address,
+; the master reads as many bytes as it acknowledges. The whole transfer is
+; sent from interrupt service and the internal timer, the task down
+; counters and their reloads are updated in the main loop with interrupts
+; disabled, so these multi-byte values are read either before or after an
+; update, never in the middle of one.
+cmd6a           movf    i2crec1, W
+                sublw   H'07'              
+                btfss   STATUS, Z
+                goto    cmd6b
+                movf    i2crec2, W
+                movwf   i2ctxptr
+                goto    loop
+
+; command 0x08 copy eight bytes from EEPROM at given address to tx buffer,
+; the copy continues over the receive buffer i2crec1:4
+cmd6b           movf    i2crec1, W
+                sublw   H'08'              
+                btfss   STATUS, Z
+                goto    cmd7
+                movlw   i2ctx1
+                movwf   FSR
+                movlw   8
+                movwf   i2crec5             ; byte counter
+                movf    i2crec2, W
+                bsf     STATUS, RP0         ; bank 1
+                movwf   EEADR
+eecopy          bsf     EECON1, RD          ; read EEPROM byte  
+                movf    EEDATA, W
+                incf    EEADR, F
+                movwf   INDF
+                incf    FSR, F
+                decfsz  i2crec5, F
+                goto    eecopy
+                bcf     STATUS, RP0         ; bank 0
+                goto    loop
+
 ; command 0x10 clear GPIO0=0 output 
 cmd7            movf    i2crec1, W
                 sublw   H'10'
@@ -1192,7 +1238,7 @@ cmd20           movf    i2crec1, W
                 movlw   B'10000001' ; switch on A/D, VREF=VDD, AN0
                 movwf   ADCON0
                 bsf     ADCON0, GO  ; start conversion
-wadc0           btfss   ADCON0, NOT_DONE
+wadc0           btfsc   ADCON0, NOT_DONE
                 goto    wadc0
                 movf    ADRESH, W 
                 movwf   i2ctx1 
@@ -1210,7 +1256,7 @@ cmd21           movf    i2crec1, W
                 movlw   B'10000101' ; switch on A/D, VREF=VDD, AN1
                 movwf   ADCON0
                 bsf     ADCON0, GO  ; start conversion
-wadc1           btfss   ADCON0, NOT_DONE
+wadc1           btfsc   ADCON0, NOT_DONE
                 goto    wadc1
                 movf    ADRESH, W 
                 movwf   i2ctx1 
@@ -1224,11 +1270,11 @@ wadc1           btfss   ADCON0, NOT_DONE
 cmd22           movf    i2crec1, W
                 sublw   H'43'
                 btfss   STATUS, Z
-                goto    cmd23
+                goto    cmd22a
                 movlw   B'10001101' ; switch on A/D, VREF=VDD, AN3
                 movwf   ADCON0
                 bsf     ADCON0, GO  ; start conversion
-wadc3           btfss   ADCON0, NOT_DONE
+wadc3           btfsc   ADCON0, NOT_DONE
                 goto    wadc3
                 movf    ADRESH, W 
                 movwf   i2ctx1 
@@ -1238,6 +1284,86 @@ wadc3           btfss   ADCON0, NOT_DONE
                 bcf     STATUS, RP0         ; bank 0
                 goto    loop
 
+; command 0x44 N back-to-back A/D conversions on channel 0, 1 or 3 given in
+; i2crec2, N=1-64 in i2crec3 and 0 means 64. The first conversion after the
+; channel change is dropped. Reply is 16-bit sum in i2ctx1:2, minimum in
+; i2ctx3:4 and maximum in i2crec1:2, the sample is kept in i2crec4:5 and
+; the counter in i2crec3. The conversions take up to 100 us each, so the
+; reply should be read after that.
+cmd22a          movf    i2crec1, W
+                sublw   H'44'
+                btfss   STATUS, Z
+                goto    cmd23
+                movf    i2crec2, W
+                andlw   B'00000011'
+                movwf   i2crec4
+                bcf     STATUS, C
+                rlf     i2crec4, F
+                rlf     i2crec4, W  ; channel bits CHS1:CHS0 to bits 3:2
+                iorlw   B'10000001' ; switch on A/D, VREF=VDD
+                movwf   ADCON0
+                movf    i2crec3, W
+                andlw   B'00111111'
+                btfsc   STATUS, Z
+                movlw   64
+                movwf   i2crec3
+                clrf    i2ctx1      ; sum=0
+                clrf    i2ctx2
+                movlw   H'03'       ; minimum=0x3FF
+                movwf   i2ctx3
+                movlw   H'FF'
+                movwf   i2ctx4
+                clrf    i2crec1     ; maximum=0
+                clrf    i2crec2
+                movlw   7           ; acquisition delay about 20 us
+                movwf   i2crec5
+adcacq          decfsz  i2crec5, F
+                goto    adcacq
+                bsf     ADCON0, GO  ; first conversion is not used
+wadcs0          btfsc   ADCON0, NOT_DONE
+                goto    wadcs0
+adcsum          bsf     ADCON0, GO  ; start conversion
+wadcs           btfsc   ADCON0, NOT_DONE
+                goto    wadcs
+                movf    ADRESH, W
+                movwf   i2crec5
+                bsf     STATUS, RP0         ; bank 1
+                movf    ADRESL, W
+                bcf     STATUS, RP0         ; bank 0
+                movwf   i2crec4
+                addwf   i2ctx2, F   ; sum+=sample
+                btfsc   STATUS, C
+                incf    i2ctx1, F
+                movf    i2crec5, W
+                addwf   i2ctx1, F
+                movf    i2crec4, W  ; minimum-sample, C=1 if sample<=minimum
+                subwf   i2ctx4, W
+                movf    i2crec5, W
+                btfss   STATUS, C
+                addlw   1
+                subwf   i2ctx3, W
+                btfss   STATUS, C
+                goto    adcmax
+                movf    i2crec5, W
+                movwf   i2ctx3
+                movf    i2crec4, W
+                movwf   i2ctx4
+adcmax          movf    i2crec2, W  ; sample-maximum, C=1 if sample>=maximum
+                subwf   i2crec4, W
+                movf    i2crec1, W
+                btfss   STATUS, C
+                addlw   1
+                subwf   i2crec5, W
+                btfss   STATUS, C
+                goto    adcnxt
+                movf    i2crec5, W
+                movwf   i2crec1
+                movf    i2crec4, W
+                movwf   i2crec2
+adcnxt          decfsz  i2crec3, F
+                goto    adcsum
+                goto    loop
+
 ; command 0x50 reset internal timer
 cmd23           movf    i2crec1, W
                 sublw   H'50'
@@ -1473,6 +1599,7 @@ cmd44           nop
 
 ; increase internal timer every 0.524288 seconds (assuming 1:8 prescaler) 
 nxtime          bcf     PIR1, TMR1IF
+                bcf     INTCON, GIE         ; disable interrupts
                 incf    time4, F            ; time4++ 
                 btfss   STATUS, Z
                 goto    timedone               
@@ -1484,26 +1611,24 @@ nxtime          bcf     PIR1, TMR1IF
                 goto    timedone
                 incf    time1, F            ; time1++
  
-timedone        btfss   task1, TACTIVE
+; the down counters and their reloads are changed with interrupts disabled
+; so that a read from interrupt service sees all three bytes of a counter
+; either before or after the change, the task command is run afterwards
+timedone        bsf     INTCON, GIE         ; enable interrupts
+                btfss   task1, TACTIVE
                 goto    nxtask 
                 call    blink               ; blink LED once
+                bcf     INTCON, GIE         ; disable interrupts
                 movlw   H'01'
                 subwf   task1cnt3, F        ; task1cnt3--
                 btfsc   STATUS, C 
-                goto    nxtask 
+                goto    nxtaskei 
                 subwf   task1cnt2, F        ; task1cnt2--
                 btfsc   STATUS, C
-                goto    nxtask 
+                goto    nxtaskei 
                 subwf   task1cnt1, F        ; task1cnt1--
                 btfsc   STATUS, C
-                goto    nxtask 
-
-; copy task1 command to task command and execute
-                movf    task1cmd1, W
-                movwf   taskcmd1
-                movf    task1cmd2, W
-                movwf   taskcmd2
-                call    dotask
+                goto    nxtaskei 
 
 ; reinitialize counting down time and decrease counter by one
                 movf    task1tm1, W
@@ -1513,27 +1638,32 @@ timedone        btfss   task1, TACTIVE
                 movf    task1tm3, W
                 movwf   task1cnt3
                 decf    task1, F              ; task1--
+                bsf     INTCON, GIE         ; enable interrupts
+
+; copy task1 command to task command and execute
+                movf    task1cmd1, W
+                movwf   taskcmd1
+                movf    task1cmd2, W
+                movwf   taskcmd2
+                call    dotask
+                goto    nxtask
+
+nxtaskei        bsf     INTCON, GIE         ; enable interrupts
 
 nxtask          btfss   task2, TACTIVE
                 goto    nxtask2 
-                call    blink
+                call    blink               ; blink LED once
+                bcf     INTCON, GIE         ; disable interrupts
                 movlw   H'01'
                 subwf   task2cnt3, F        ; task2cnt3--
                 btfsc   STATUS, C 
-                goto    nxtask2 
+                goto    nxtask2ei 
                 subwf   task2cnt2, F        ; task2cnt2--
                 btfsc   STATUS, C
-                goto    nxtask2 
+                goto    nxtask2ei 
                 subwf   task2cnt1, F        ; task2cnt1--
                 btfsc   STATUS, C
-                goto    nxtask2 
-
-; copy task1 command to task command and execute
-                movf    task2cmd1, W
-                movwf   taskcmd1
-                movf    task2cmd2, W
-                movwf   taskcmd2
-                call    dotask
+                goto    nxtask2ei 
 
 ; reinitialize counting down time and decrease counter by one
                 movf    task2tm1, W
@@ -1543,6 +1673,17 @@ nxtask          btfss   task2, TACTIVE
                 movf    task2tm3, W
                 movwf   task2cnt3
                 decf    task2, F              ; task2--
+                bsf     INTCON, GIE         ; enable interrupts
+
+; copy task2 command to task command and execute
+                movf    task2cmd1, W
+                movwf   taskcmd1
+                movf    task2cmd2, W
+                movwf   taskcmd2
+                call    dotask
+                goto    nxtask2
+
+nxtask2ei       bsf     INTCON, GIE         ; enable interrupts
 
 nxtask2         nop
                 goto    loop
@@ -0,0 +1,34 @@
+#!/bin/sh
+# run pipicswd against the PiPIC simulator and time status queries
+# usage: sudo shell/simbench.sh [queries] [bitrate]
+# needs 'I2CBUSD 1' in /etc/pipicswd_config, run from the source directory
+N=${1:-100}
+BITRATE=${2:-10000}
+SRC=${PWD}/src
+
+if ! /bin/grep -q "^I2CBUSD 1" /etc/pipicswd_config; then
+  echo "Set I2CBUSD 1 in /etc/pipicswd_config first"
+  exit 1
+fi
+
+${SRC}/pipicsim -b ${BITRATE} > /tmp/pipicsim.log &
+SIMPID=$!
+/bin/sleep 1
+${SRC}/pipicswd
+/bin/sleep 3
+
+START=$(/bin/date +%s.%N)
+i=0
+while [ $i -lt $N ]; do
+  ${SRC}/pipicsw status > /dev/null
+  i=$((i+1))
+done
+END=$(/bin/date +%s.%N)
+
+/bin/kill $(/bin/cat /run/pipicswd.pid)
+/bin/sleep 2
+/bin/kill -INT ${SIMPID}
+wait ${SIMPID}
+
+/usr/bin/awk "BEGIN { printf \"%d status queries in %.3f s\\n\", ${N}, ${END} - ${START} }"
+/bin/cat /tmp/pipicsim.log
@@ -0,0 +1,122 @@
+#include "battstate.h"
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// the battery state is one small file on tmpfs mapped to memory, the only
+// writer is pipicpowerd and it updates all values at once under a sequence
+// count, readers copy the values and retry if the count was odd or changed
+// during the copy so they never see half of an update and never block it
+
+// create or reuse the state file and map it for writing
+// return: mapped state, NULL=failed
+struct battstate *battstate_create(const char *path)
+{
+  int fd;
+  struct battstate *bs;
+
+  fd = open( path, O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+  if( fd < 0 ) return NULL;
+
+  if( ftruncate( fd, sizeof(struct battstate) ) != 0 )
+  {
+    close( fd );
+    return NULL;
+  }
+
+  bs = mmap( NULL, sizeof(struct battstate), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( bs == MAP_FAILED ) return NULL;
+
+// the header is written under an odd count so that a reader of an older
+// file does not take it for valid
+  atomic_store_explicit( &bs->seq, atomic_load_explicit( &bs->seq, memory_order_relaxed ) | 1, memory_order_relaxed );
+  atomic_thread_fence( memory_order_release );
+  bs->magic = BATTSTATEMAGIC;
+  bs->version = BATTSTATEVERSION;
+  bs->size = sizeof(struct battvalues);
+  memset( &bs->v, 0, sizeof(bs->v) );
+  bs->v.battery = -1;
+  bs->v.temp = -100;
+  bs->v.cputemp = -100;
+  atomic_store_explicit( &bs->seq, atomic_load_explicit( &bs->seq, memory_order_relaxed ) + 1, memory_order_release );
+
+  return bs;
+}
+
+// map existing state file for reading
+// return: mapped state, NULL=failed or not a known version
+struct battstate *battstate_open(const char *path)
+{
+  int fd;
+  struct stat st;
+  struct battstate *bs;
+
+  fd = open( path, O_RDONLY | O_CLOEXEC );
+  if( fd < 0 ) return NULL;
+
+  if( fstat( fd, &st ) != 0 || st.st_size < (off_t)sizeof(struct battstate) )
+  {
+    close( fd );
+    return NULL;
+  }
+
+  bs = mmap( NULL, sizeof(struct battstate), PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( bs == MAP_FAILED ) return NULL;
+
+  if( bs->magic != BATTSTATEMAGIC || bs->version != BATTSTATEVERSION || bs->size != sizeof(struct battvalues) )
+  {
+    munmap( bs, sizeof(struct battstate) );
+    return NULL;
+  }
+
+  return bs;
+}
+
+void battstate_close(struct battstate *bs)
+{
+  if( bs != NULL ) munmap( bs, sizeof(struct battstate) );
+}
+
+// write all values, only one writer is allowed
+void battstate_write(struct battstate *bs, const struct battvalues *v)
+{
+  unsigned int s;
+
+  if( bs == NULL ) return;
+
+  s = atomic_load_explicit( &bs->seq, memory_order_relaxed );
+  atomic_store_explicit( &bs->seq, s + 1, memory_order_relaxed );
+  atomic_thread_fence( memory_order_release );
+  memcpy( &bs->v, v, sizeof(*v) );
+  atomic_store_explicit( &bs->seq, s + 2, memory_order_release );
+}
+
+// copy consistent snapshot of the values
+// return: 1=ok, -1=writer did not finish an update in time
+int battstate_read(const struct battstate *bs, struct battvalues *v)
+{
+  unsigned int s1, s2;
+  int n;
+
+  for( n = 0; n < BATTSTATERETRY; n++ )
+  {
+    s1 = atomic_load_explicit( (atomic_uint *)&bs->seq, memory_order_acquire );
+    if( s1 & 1 )
+    {
+      sched_yield();
+      continue;
+    }
+    memcpy( v, &bs->v, sizeof(*v) );
+    atomic_thread_fence( memory_order_acquire );
+    s2 = atomic_load_explicit( (atomic_uint *)&bs->seq, memory_order_relaxed );
+    if( s1 == s2 ) return 1;
+  }
+
+  return -1;
+}
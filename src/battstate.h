@@ -0,0 +1,34 @@
+#ifndef BATTSTATE_H_INCLUDED
+#define BATTSTATE_H_INCLUDED
+#include <stdint.h>
+#include <stdatomic.h>
+#define BATTSTATEMAGIC 0x54534250 // "PBST" in little endian
+#define BATTSTATEVERSION 1 // changed when struct battvalues changes
+#define BATTSTATERETRY 1000 // reader retries before giving up
+struct battvalues
+{
+  int64_t time; // time of voltage reading, seconds since the epoch
+  int64_t timertime; // time of PIC timer reading, seconds since the epoch
+  int32_t battery; // A/D reading 1023 - 0, -1=failed
+  int32_t timer; // PIC internal timer
+  float volts; // battery voltage [V]
+  float battlevel; // battery level [%]
+  float hoursleft; // hours left before battery flat
+  float ophours; // hours left before minimum battery level
+  float temp; // ambient temperature [C], -100=not known
+  float cputemp; // CPU temperature [C], -100=not known
+};
+struct battstate
+{
+  uint32_t magic; // BATTSTATEMAGIC
+  uint32_t version; // BATTSTATEVERSION
+  uint32_t size; // sizeof(struct battvalues)
+  atomic_uint seq; // odd while values are written
+  struct battvalues v;
+};
+struct battstate *battstate_create(const char *path);
+struct battstate *battstate_open(const char *path);
+void battstate_close(struct battstate *bs);
+void battstate_write(struct battstate *bs, const struct battvalues *v);
+int battstate_read(const struct battstate *bs, struct battvalues *v);
+#endif
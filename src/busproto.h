@@ -0,0 +1,25 @@
+#ifndef BUSPROTO_H_INCLUDED
+#define BUSPROTO_H_INCLUDED
+#define BUSSOCKET "/run/pipicbusd.sock" // pipicbusd seqpacket socket
+#define BUSMAXDATA 32 // maximum number of bytes to write or read in one request
+#define BUS_HOLD 0x01 // reserve the slave address for this client after transfer
+#define BUS_RELEASE 0x02 // release reserved slave address, no transfer
+#define BUSPRIO_BULK 1 // memory and EEPROM reads
+#define BUSPRIO_NORMAL 2 // other commands
+#define BUSPRIO_URGENT 3 // button polling and direct GPIO writes like motor stop
+struct busreq
+{
+  unsigned char addr; // i2c slave address
+  unsigned char flags; // BUS_HOLD or BUS_RELEASE
+  unsigned char prio; // 0=priority from command byte, otherwise BUSPRIO_*
+  unsigned char wlength; // number of bytes to write
+  unsigned char rlength; // number of bytes to read after writing
+  unsigned char wbuf[ BUSMAXDATA ];
+};
+struct busrep
+{
+  signed char status; // 1=ok, otherwise error from i2c_session_*()
+  unsigned char rlength; // number of bytes read
+  unsigned char rbuf[ BUSMAXDATA ];
+};
+#endif
@@ -0,0 +1,133 @@
+#include "clockchk.h"
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <syslog.h>
+#include <sys/ioctl.h>
+#include <sys/timex.h>
+#include <sys/timerfd.h>
+#include <linux/rtc.h>
+
+// the system clock is checked in-process, the kernel tells with adjtimex()
+// if an NTP daemon keeps the clock synchronized and a hardware RTC is found
+// by reading its time, the answer is cached until the clock is set which
+// the kernel reports through a timerfd with TFD_TIMER_CANCEL_ON_SET
+
+#define CLOCKCHKARM 31536000 // timerfd expiration from now [s]
+
+static int ntp_rtc = -1; // cached answer, -1=not known
+
+// is the system clock synchronized by NTP
+// return: 1=yes, 0=no
+int clockchk_synced(void)
+{
+  struct timex tx;
+  int state;
+
+  memset( &tx, 0, sizeof(tx) ); // modes 0 only reads
+  state = adjtimex( &tx );
+  if( state == -1 || state == TIME_ERROR || ( tx.status & STA_UNSYNC ) ) return 0;
+
+  syslog( LOG_INFO, "clock synchronized, max error %ld us, estimated error %ld us", tx.maxerror, tx.esterror );
+
+  return 1;
+}
+
+// is there an RTC device with valid time
+// return: 1=yes, 0=no
+int clockchk_rtc(void)
+{
+  DIR *dir;
+  struct dirent *de;
+  struct rtc_time rt;
+  char dev[ 280 ];
+  int fd, ok = 0;
+
+  dir = opendir( "/dev" );
+  if( dir == NULL ) return 0;
+
+  while( ok == 0 && ( de = readdir( dir ) ) != NULL )
+  {
+    if( strncmp( de->d_name, "rtc", 3 ) != 0 ) continue;
+    snprintf( dev, sizeof(dev), "/dev/%s", de->d_name );
+    fd = open( dev, O_RDONLY | O_CLOEXEC );
+    if( fd < 0 ) continue;
+// unset RTC time gives EINVAL
+    if( ioctl( fd, RTC_RD_TIME, &rt ) == 0 )
+    {
+      ok = 1;
+      syslog( LOG_INFO, "RTC %s at %04d-%02d-%02d %02d:%02d:%02d", dev, rt.tm_year + 1900, rt.tm_mon + 1, rt.tm_mday, rt.tm_hour, rt.tm_min, rt.tm_sec );
+    }
+    close( fd );
+  }
+  closedir( dir );
+
+  return ok;
+}
+
+// arm timer far in the future, it is cancelled when the clock is set
+static int clockchk_arm(int fd)
+{
+  struct itimerspec its;
+
+  memset( &its, 0, sizeof(its) );
+  clock_gettime( CLOCK_REALTIME, &its.it_value );
+  its.it_value.tv_sec += CLOCKCHKARM;
+
+  return timerfd_settime( fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL );
+}
+
+// open timerfd that becomes readable when the clock is set
+// return: file descriptor, -1=failed
+int clockchk_open(void)
+{
+  int fd;
+
+  fd = timerfd_create( CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC );
+  if( fd < 0 ) return -1;
+
+  if( clockchk_arm( fd ) < 0 )
+  {
+    close( fd );
+    return -1;
+  }
+
+  return fd;
+}
+
+// event loop callback for the timerfd, forget cached answer if the clock
+// was set and arm the timer again
+void clockchk_event(int fd)
+{
+  uint64_t exp;
+
+  if( read( fd, &exp, sizeof(exp) ) < 0 )
+  {
+    if( errno == EAGAIN ) return;
+    if( errno == ECANCELED ) syslog( LOG_INFO, "system clock was set" );
+  }
+
+  ntp_rtc = -1;
+  clockchk_arm( fd );
+}
+
+// is the time kept by NTP or RTC, cached between clock changes
+// return: 1=yes, 0=no
+int clockchk_ntp_rtc(void)
+{
+  if( ntp_rtc == -1 )
+  {
+    ntp_rtc = 0;
+    if( clockchk_synced() == 1 ) ntp_rtc = 1;
+    else syslog( LOG_INFO, "clock not synchronized by NTP" );
+    if( clockchk_rtc() == 1 ) ntp_rtc = 1;
+    else syslog( LOG_INFO, "no RTC" );
+  }
+
+  return ntp_rtc;
+}
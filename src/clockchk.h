@@ -0,0 +1,8 @@
+#ifndef CLOCKCHK_H_INCLUDED
+#define CLOCKCHK_H_INCLUDED
+int clockchk_synced(void);
+int clockchk_rtc(void);
+int clockchk_open(void);
+void clockchk_event(int fd);
+int clockchk_ntp_rtc(void);
+#endif
@@ -0,0 +1,68 @@
+#include "cmdbatch.h"
+#include <string.h>
+#include <stdio.h>
+#include <syslog.h>
+#include "i2csession.h"
+#include "writecmd.h"
+
+// empty command batch
+void cmdbatch_init(struct cmdbatch *batch)
+{
+  batch->n = 0;
+}
+
+// queue command with optional data, length is the number of data bytes
+// return: 1=ok, 0=batch full
+int cmdbatch_add(struct cmdbatch *batch, int cmd, int data, int length)
+{
+  int i = batch->n;
+
+  if( i >= CMDBATCHMAX )
+  {
+    syslog( LOG_ERR, "Command batch full, 0x%02x not queued", cmd );
+    return 0;
+  }
+
+  batch->cmd[ i ] = cmd;
+  batch->data[ i ] = data;
+  batch->length[ i ] = length;
+  batch->result[ i ] = 0;
+  batch->n++;
+
+  return 1;
+}
+
+// send all queued commands while the i2c port is locked once, sending stops
+// at the first failed command and the rest are left with result 0
+// return: 1=all commands sent, otherwise the first error from write_cmd()
+int cmdbatch_flush(struct cmdbatch *batch)
+{
+  int ok = 1;
+  int i;
+
+  for( i = 0; i < batch->n; i++ ) batch->result[ i ] = 0;
+
+  if( batch->n == 0 ) return ok;
+
+  ok = i2c_session_lock( &i2cses );
+  if( ok != 1 )
+  {
+    syslog( LOG_ERR, "Command batch of %d not sent", batch->n );
+    return ok;
+  }
+
+  for( i = 0; i < batch->n; i++ )
+  {
+    batch->result[ i ] = write_cmd( batch->cmd[ i ], batch->data[ i ], batch->length[ i ] );
+    if( batch->result[ i ] != 1 )
+    {
+      ok = batch->result[ i ];
+      syslog( LOG_ERR, "Command 0x%02x failed (%d), %d of %d commands sent", batch->cmd[ i ], ok, i, batch->n );
+      break;
+    }
+  }
+
+  i2c_session_unlock( &i2cses );
+
+  return ok;
+}
@@ -0,0 +1,15 @@
+#ifndef CMDBATCH_H_INCLUDED
+#define CMDBATCH_H_INCLUDED
+#define CMDBATCHMAX 16 // maximum number of commands in one batch
+struct cmdbatch
+{
+  int n; // number of queued commands
+  int cmd[ CMDBATCHMAX ]; // command bytes
+  int data[ CMDBATCHMAX ]; // command data
+  int length[ CMDBATCHMAX ]; // number of data bytes 0, 1, 2 or 4
+  int result[ CMDBATCHMAX ]; // 1=ok, 0=not sent, <0 error from write_cmd()
+};
+void cmdbatch_init(struct cmdbatch *batch);
+int cmdbatch_add(struct cmdbatch *batch, int cmd, int data, int length);
+int cmdbatch_flush(struct cmdbatch *batch);
+#endif
@@ -0,0 +1,231 @@
+#include "evloop.h"
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <syslog.h>
+
+// the tasks are kept in a small table and the earliest deadline is found
+// by scanning it, the timerfd is armed only for the next due task so the
+// process sleeps in epoll_wait() when nothing is due
+
+// monotonic time in seconds
+double evloop_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// create epoll instance and timerfd
+// return: 1=ok, -1=failed
+int evloop_init(struct evloop *ev)
+{
+  struct epoll_event e;
+
+  memset( ev, 0, sizeof(struct evloop) );
+  ev->armed = -1;
+  ev->tfd = -1;
+
+  if( ( ev->epfd = epoll_create1( EPOLL_CLOEXEC ) ) < 0 )
+  {
+    syslog( LOG_ERR, "Could not create epoll instance" );
+    return -1;
+  }
+
+  if( ( ev->tfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) < 0 )
+  {
+    syslog( LOG_ERR, "Could not create timerfd" );
+    close( ev->epfd );
+    return -1;
+  }
+
+  memset( &e, 0, sizeof(e) );
+  e.events = EPOLLIN;
+  e.data.fd = ev->tfd;
+  epoll_ctl( ev->epfd, EPOLL_CTL_ADD, ev->tfd, &e );
+
+  return 1;
+}
+
+// close epoll instance and timerfd, watched descriptors are left open
+void evloop_close(struct evloop *ev)
+{
+  if( ev->tfd >= 0 ) close( ev->tfd );
+  if( ev->epfd >= 0 ) close( ev->epfd );
+  ev->tfd = ev->epfd = -1;
+}
+
+// add task to run after delay [s], with delay <0 the task waits for
+// evloop_schedule()
+// return: task id, -1=table full
+int evloop_task(struct evloop *ev, double (*run)(void), double delay)
+{
+  int id = ev->ntask;
+
+  if( id >= EVTASKMAX )
+  {
+    syslog( LOG_ERR, "Task table full" );
+    return -1;
+  }
+
+  ev->task[ id ].run = run;
+  ev->task[ id ].due = -1;
+  ev->ntask++;
+  evloop_schedule( ev, id, delay );
+
+  return id;
+}
+
+// run task after delay [s] from now, delay <0 cancels the task
+void evloop_schedule(struct evloop *ev, int id, double delay)
+{
+  if( id < 0 || id >= ev->ntask ) return;
+
+  if( delay < 0 ) ev->task[ id ].due = -1;
+  else ev->task[ id ].due = evloop_now() + delay;
+}
+
+// call ready() each time fd is readable
+// return: 1=ok, -1=failed
+int evloop_watch(struct evloop *ev, int fd, void (*ready)(int fd))
+{
+  struct epoll_event e;
+
+  if( ev->nwatch >= EVWATCHMAX )
+  {
+    syslog( LOG_ERR, "Watch table full" );
+    return -1;
+  }
+
+  memset( &e, 0, sizeof(e) );
+  e.events = EPOLLIN;
+  e.data.fd = fd;
+  if( epoll_ctl( ev->epfd, EPOLL_CTL_ADD, fd, &e ) < 0 )
+  {
+    syslog( LOG_ERR, "Could not watch file descriptor %d", fd );
+    return -1;
+  }
+
+  ev->watch[ ev->nwatch ].fd = fd;
+  ev->watch[ ev->nwatch ].ready = ready;
+  ev->nwatch++;
+
+  return 1;
+}
+
+// stop watching fd, this must be done before closing it
+void evloop_unwatch(struct evloop *ev, int fd)
+{
+  int i;
+
+  epoll_ctl( ev->epfd, EPOLL_CTL_DEL, fd, NULL );
+
+  for( i = 0; i < ev->nwatch; i++ )
+  {
+    if( ev->watch[ i ].fd == fd )
+    {
+      ev->watch[ i ] = ev->watch[ ev->nwatch - 1 ];
+      ev->nwatch--;
+      break;
+    }
+  }
+}
+
+// arm timerfd for the earliest due task or disarm it if none is scheduled
+static void evloop_arm(struct evloop *ev)
+{
+  int i;
+  double due = -1;
+  struct itimerspec its;
+
+  for( i = 0; i < ev->ntask; i++ )
+  {
+    if( ev->task[ i ].due >= 0 && ( due < 0 || ev->task[ i ].due < due ) ) due = ev->task[ i ].due;
+  }
+
+  if( due == ev->armed ) return;
+
+  memset( &its, 0, sizeof(its) );
+  if( due >= 0 )
+  {
+    its.it_value.tv_sec = (time_t)due;
+    its.it_value.tv_nsec = (long)( ( due - its.it_value.tv_sec ) * 1e9 );
+    if( its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0 ) its.it_value.tv_nsec = 1;
+  }
+  timerfd_settime( ev->tfd, TFD_TIMER_ABSTIME, &its, NULL );
+  ev->armed = due;
+}
+
+// run due tasks, the next run is counted from the previous deadline so
+// that a slow task does not shift the schedule, a task late by more than
+// its period is run once and then rescheduled from now
+static void evloop_tasks(struct evloop *ev)
+{
+  int i;
+  double now = evloop_now();
+  double due, delay;
+
+  for( i = 0; i < ev->ntask; i++ )
+  {
+    due = ev->task[ i ].due;
+    if( due < 0 || due > now ) continue;
+
+    ev->task[ i ].due = -1;
+    delay = ev->task[ i ].run();
+
+    if( ev->task[ i ].due >= 0 ) continue; // rescheduled by the task itself
+    if( delay < 0 ) continue;
+
+    due += delay;
+    now = evloop_now();
+    if( due < now ) due = now;
+    ev->task[ i ].due = due;
+  }
+}
+
+// wait until a task is due or a watched fd is readable and handle it
+// return: 1=ok, 0=interrupted by signal, -1=failed
+int evloop_run(struct evloop *ev)
+{
+  struct epoll_event e[ 8 ];
+  unsigned long long exp;
+  int n, i, j;
+
+  evloop_arm( ev );
+
+  n = epoll_wait( ev->epfd, e, 8, -1 );
+  if( n < 0 )
+  {
+    if( errno == EINTR ) return 0;
+    syslog( LOG_ERR, "epoll_wait failed" );
+    return -1;
+  }
+
+  for( i = 0; i < n; i++ )
+  {
+    if( e[ i ].data.fd == ev->tfd )
+    {
+      if( read( ev->tfd, &exp, sizeof(exp) ) > 0 ) ev->armed = -1;
+      continue;
+    }
+
+    for( j = 0; j < ev->nwatch; j++ )
+    {
+      if( ev->watch[ j ].fd == e[ i ].data.fd )
+      {
+        ev->watch[ j ].ready( e[ i ].data.fd );
+        break;
+      }
+    }
+  }
+
+  evloop_tasks( ev );
+
+  return 1;
+}
@@ -0,0 +1,33 @@
+#ifndef EVLOOP_H_INCLUDED
+#define EVLOOP_H_INCLUDED
+#define EVTASKMAX 16 // maximum number of scheduled tasks
+#define EVWATCHMAX 64 // maximum number of watched file descriptors
+struct evtask
+{
+  double due; // monotonic time to run the task [s], <0=not scheduled
+  double (*run)(void); // returns delay to next run [s], <0=not scheduled
+};
+struct evwatch
+{
+  int fd; // watched file descriptor
+  void (*ready)(int fd); // called when fd is readable
+};
+struct evloop
+{
+  int epfd; // epoll instance
+  int tfd; // timerfd armed for the next due task
+  double armed; // time the timerfd is armed for, <0=disarmed
+  int ntask; // number of tasks
+  struct evtask task[ EVTASKMAX ];
+  int nwatch; // number of watched file descriptors
+  struct evwatch watch[ EVWATCHMAX ];
+};
+double evloop_now(void);
+int evloop_init(struct evloop *ev);
+void evloop_close(struct evloop *ev);
+int evloop_task(struct evloop *ev, double (*run)(void), double delay);
+void evloop_schedule(struct evloop *ev, int id, double delay);
+int evloop_watch(struct evloop *ev, int fd, void (*ready)(int fd));
+void evloop_unwatch(struct evloop *ev, int fd);
+int evloop_run(struct evloop *ev);
+#endif
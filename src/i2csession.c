@@ -0,0 +1,334 @@
+#include "i2csession.h"
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <sys/ioctl.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include "pipichbd.h"
+#include "busproto.h"
+#include "i2cstats.h"
+
+// the i2c device is opened and the slave bound on first use, after this
+// only the flock() is done for each transaction
+struct i2c_session i2cses = { NULL, 0, 0, -1, 0, 0, 0, 0, 0 };
+
+// connect to pipicbusd socket
+// return: 1=ok, -1=connection failed
+static int i2c_session_connect(struct i2c_session *ses)
+{
+  struct sockaddr_un addr;
+
+  if( ( ses->fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 ) ) < 0 )
+  {
+    syslog( LOG_ERR, "Could not open socket to pipicbusd" );
+    return -1;
+  }
+
+  memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+  strncpy( addr.sun_path, BUSSOCKET, sizeof(addr.sun_path) - 1 );
+
+  if( connect( ses->fd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 )
+  {
+    syslog( LOG_ERR, "Failed to connect pipicbusd" );
+    close( ses->fd );
+    ses->fd = -1;
+    return -1;
+  }
+  ses->held = 0;
+
+  return 1;
+}
+
+// send one request to pipicbusd and wait for the reply, the slave address
+// is kept reserved while an outer lock is held, write_cmd(), read_data()
+// and i2c_session_xfer() take the first lock level themselves
+// return: 1=ok, 0=socket failed, otherwise error from pipicbusd
+static int i2c_session_bus(struct i2c_session *ses, int flags, const unsigned char *wbuf, int wlength, unsigned char *rbuf, int rlength)
+{
+  struct busreq req;
+  struct busrep rep;
+
+  if( wlength > BUSMAXDATA || rlength > BUSMAXDATA ) return 0;
+
+  memset( &req, 0, sizeof(req) );
+  req.addr = ses->addr;
+  req.flags = flags;
+  if( ses->locked > 1 ) req.flags |= BUS_HOLD;
+  req.wlength = wlength;
+  req.rlength = rlength;
+  if( wlength > 0 ) memcpy( req.wbuf, wbuf, wlength );
+
+  if( ses->fd < 0 ) return 0;
+  if( send( ses->fd, &req, sizeof(req), MSG_NOSIGNAL ) != sizeof(req) ) return 0;
+  if( recv( ses->fd, &rep, sizeof(rep), 0 ) != sizeof(rep) ) return 0;
+
+  if( req.flags & BUS_HOLD ) ses->held = 1;
+  if( req.flags & BUS_RELEASE ) ses->held = 0;
+  if( rep.status == 1 && rlength > 0 ) memcpy( rbuf, rep.rbuf, rlength );
+
+  return rep.status;
+}
+
+// open i2c device and bind slave address if not open already
+// return: 1=ok, -1=open failed, -3=bus access failed
+int i2c_session_open(struct i2c_session *ses)
+{
+  if( ses->fd >= 0 ) return 1;
+
+  if( ses->dev == NULL )
+  {
+    ses->dev = i2cdev;
+    ses->addr = address;
+    ses->lockmax = i2lockmax;
+  }
+
+  if( ses->busd == 1 ) return i2c_session_connect( ses );
+
+  if( ( ses->fd = open( ses->dev, O_RDWR | O_CLOEXEC ) ) < 0 )
+  {
+    syslog( LOG_ERR, "Failed to open i2c port" );
+    return -1;
+  }
+
+  if( ioctl( ses->fd, I2C_SLAVE, ses->addr ) < 0 )
+  {
+    syslog( LOG_ERR, "Unable to get bus access to talk to slave" );
+    close( ses->fd );
+    ses->fd = -1;
+    return -3;
+  }
+
+  return 1;
+}
+
+// close i2c device, this releases also the lock
+void i2c_session_close(struct i2c_session *ses)
+{
+  if( ses->fd >= 0 ) close( ses->fd );
+  ses->fd = -1;
+  ses->held = 0;
+}
+
+// try to lock the open i2c port with 1 s retries
+// return: 1=ok, -2=lock failed
+static int i2c_session_flock(struct i2c_session *ses)
+{
+  int rd;
+  int cnt = ses->lockmax;
+
+  rd = flock( ses->fd, LOCK_EX | LOCK_NB );
+  while( rd != 0 && cnt > 0 ) // try again if port locking failed
+  {
+    sleep( 1 );
+    rd = flock( ses->fd, LOCK_EX | LOCK_NB );
+    cnt--;
+  }
+
+  if( rd )
+  {
+    syslog( LOG_ERR, "Failed to lock i2c port" );
+    return -2;
+  }
+
+  return 1;
+}
+
+// lock i2c port for a transaction, nested calls only increase the count
+// return: 1=ok, -1=open failed, -2=lock failed, -3=bus access failed
+int i2c_session_lock(struct i2c_session *ses)
+{
+  int ok;
+  double t;
+
+  if( ses->locked > 0 )
+  {
+    ses->locked++;
+    return 1;
+  }
+
+  ok = i2c_session_open( ses );
+  if( ok != 1 ) return ok;
+
+  if( ses->busd == 1 ) ok = 1; // pipicbusd serializes the bus
+  else
+  {
+    t = i2c_stats_now();
+    ok = i2c_session_flock( ses );
+    i2c_stats_add( ses->addr, I2CSTAT_LOCK, ok, i2c_stats_now() - t );
+  }
+  if( ok == 1 ) ses->locked = 1;
+
+  return ok;
+}
+
+// release i2c port after the outermost lock is released
+void i2c_session_unlock(struct i2c_session *ses)
+{
+  if( ses->locked > 0 ) ses->locked--;
+  if( ses->locked == 0 && ses->fd >= 0 )
+  {
+    if( ses->busd != 1 ) flock( ses->fd, LOCK_UN );
+    else if( ses->held == 1 ) i2c_session_bus( ses, BUS_RELEASE, NULL, 0, NULL, 0 );
+  }
+}
+
+// reopen i2c device after an error and lock it again if it was locked
+// return: 1=ok, otherwise error from i2c_session_open() or flock
+static int i2c_session_reopen(struct i2c_session *ses)
+{
+  int ok;
+
+  syslog( LOG_NOTICE, "Reopen i2c port" );
+  i2c_session_close( ses );
+  ok = i2c_session_open( ses );
+  if( ok == 1 && ses->locked > 0 && ses->busd != 1 ) ok = i2c_session_flock( ses );
+
+  return ok;
+}
+
+// transfer through pipicbusd, the request is tried once more after
+// reconnecting if the socket fails
+// return: 1=ok, -4=transfer failed, otherwise error from pipicbusd
+static int i2c_session_busxfer(struct i2c_session *ses, const unsigned char *wbuf, int wlength, unsigned char *rbuf, int rlength)
+{
+  int ok;
+
+  ok = i2c_session_bus( ses, 0, wbuf, wlength, rbuf, rlength );
+  if( ok == 0 && i2c_session_reopen( ses ) == 1 ) ok = i2c_session_bus( ses, 0, wbuf, wlength, rbuf, rlength );
+  if( ok == 0 )
+  {
+    syslog( LOG_ERR, "Transfer through pipicbusd failed" );
+    ok = -4;
+  }
+
+  return ok;
+}
+
+// write bytes to the slave, the transfer is tried once more after reopening
+// the device if it fails
+// return: 1=ok, -4=i2c slave writing failed
+static int i2c_session_wr(struct i2c_session *ses, const unsigned char *buf, int length)
+{
+  if( ses->busd == 1 ) return i2c_session_busxfer( ses, buf, length, NULL, 0 );
+
+  if( ses->fd >= 0 && write( ses->fd, buf, length ) == length ) return 1;
+
+  if( i2c_session_reopen( ses ) == 1 )
+  {
+    if( write( ses->fd, buf, length ) == length ) return 1;
+  }
+
+  syslog( LOG_ERR, "Error writing to i2c slave" );
+  return -4;
+}
+
+// read bytes from the slave, the transfer is tried once more after
+// reopening the device if it fails
+// return: 1=ok, -4=i2c slave reading failed
+static int i2c_session_rd(struct i2c_session *ses, unsigned char *buf, int length)
+{
+  if( ses->busd == 1 ) return i2c_session_busxfer( ses, NULL, 0, buf, length );
+
+  if( ses->fd >= 0 && read( ses->fd, buf, length ) == length ) return 1;
+
+  if( i2c_session_reopen( ses ) == 1 )
+  {
+    if( read( ses->fd, buf, length ) == length ) return 1;
+  }
+
+  syslog( LOG_ERR, "Unable to read from slave" );
+  return -4;
+}
+
+// write bytes to the slave, the port should be locked, the first byte is
+// the command the transaction is counted for
+// return: 1=ok, -4=i2c slave writing failed
+int i2c_session_write(struct i2c_session *ses, const unsigned char *buf, int length)
+{
+  int ok;
+  double t;
+
+  if( length > 0 ) ses->cmd = buf[ 0 ];
+
+  t = i2c_stats_now();
+  ok = i2c_session_wr( ses, buf, length );
+  i2c_stats_add( ses->addr, ses->cmd, ok, i2c_stats_now() - t );
+
+  return ok;
+}
+
+// read bytes from the slave, the port should be locked, the transaction is
+// counted for the command written last
+// return: 1=ok, -4=i2c slave reading failed
+int i2c_session_read(struct i2c_session *ses, unsigned char *buf, int length)
+{
+  int ok;
+  double t;
+
+  t = i2c_stats_now();
+  ok = i2c_session_rd( ses, buf, length );
+  i2c_stats_add( ses->addr, ses->cmd, ok, i2c_stats_now() - t );
+
+  return ok;
+}
+
+// send command bytes and read the reply while holding the lock so that no
+// other process can talk to the slave in between, with rdwr=1 both are
+// done with one I2C_RDWR and a repeated start instead of a stop, with
+// busd=1 the transfer is one request to pipicbusd
+// return: 1=ok, -1=open failed, -2=lock failed, -3=bus access failed,
+// -4=i2c slave writing or reading failed
+int i2c_session_xfer(struct i2c_session *ses, const unsigned char *wbuf, int wlength, unsigned char *rbuf, int rlength)
+{
+  int ok;
+  double t;
+  struct i2c_msg msgs[ 2 ];
+  struct i2c_rdwr_ioctl_data rdwr;
+
+  ok = i2c_session_lock( ses );
+  if( ok != 1 ) return ok;
+
+  if( wlength > 0 ) ses->cmd = wbuf[ 0 ];
+  t = i2c_stats_now();
+
+  if( ses->busd == 1 ) ok = i2c_session_busxfer( ses, wbuf, wlength, rbuf, rlength );
+  else if( ses->rdwr == 1 )
+  {
+    msgs[ 0 ].addr = ses->addr;
+    msgs[ 0 ].flags = 0;
+    msgs[ 0 ].len = wlength;
+    msgs[ 0 ].buf = (unsigned char *)wbuf;
+    msgs[ 1 ].addr = ses->addr;
+    msgs[ 1 ].flags = I2C_M_RD;
+    msgs[ 1 ].len = rlength;
+    msgs[ 1 ].buf = rbuf;
+    rdwr.msgs = msgs;
+    rdwr.nmsgs = 2;
+
+    if( ioctl( ses->fd, I2C_RDWR, &rdwr ) != 2 )
+    {
+      if( i2c_session_reopen( ses ) != 1 || ioctl( ses->fd, I2C_RDWR, &rdwr ) != 2 )
+      {
+        syslog( LOG_ERR, "Combined i2c transfer with slave failed" );
+        ok = -4;
+      }
+    }
+  }
+  else
+  {
+    ok = i2c_session_wr( ses, wbuf, wlength );
+    if( ok == 1 ) ok = i2c_session_rd( ses, rbuf, rlength );
+  }
+
+  i2c_stats_add( ses->addr, ses->cmd, ok, i2c_stats_now() - t );
+  i2c_session_unlock( ses );
+
+  return ok;
+}
@@ -0,0 +1,23 @@
+#ifndef I2CSESSION_H_INCLUDED
+#define I2CSESSION_H_INCLUDED
+struct i2c_session
+{
+  const char *dev; // i2c device file
+  int addr; // i2c slave address
+  int lockmax; // maximum number of times to try lock i2c port
+  int fd; // open i2c device or -1
+  int locked; // lock nesting count
+  int rdwr; // 1=command and reply as one I2C_RDWR with repeated start
+  int busd; // 1=transfers through pipicbusd socket instead of i2c device
+  int held; // 1=slave address reserved in pipicbusd
+  int cmd; // last command byte written, reads are counted for it
+};
+extern struct i2c_session i2cses; // session used by write_cmd() and read_data()
+int i2c_session_open(struct i2c_session *ses);
+void i2c_session_close(struct i2c_session *ses);
+int i2c_session_lock(struct i2c_session *ses);
+void i2c_session_unlock(struct i2c_session *ses);
+int i2c_session_write(struct i2c_session *ses, const unsigned char *buf, int length);
+int i2c_session_read(struct i2c_session *ses, unsigned char *buf, int length);
+int i2c_session_xfer(struct i2c_session *ses, const unsigned char *wbuf, int wlength, unsigned char *rbuf, int rlength);
+#endif
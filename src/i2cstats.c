@@ -0,0 +1,215 @@
+#include "i2cstats.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <syslog.h>
+
+// every i2c transaction is counted for each slave address and command
+// byte, a read is counted for the command written before it, the times
+// go to histograms with 8 buckets for each power of two so that the
+// relative resolution is about 12 % from microseconds to minutes
+static struct i2c_stat stats[ I2CSTATMAX ];
+static int nstats = 0;
+
+// monotonic time in seconds
+double i2c_stats_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// histogram bucket for time in microseconds, values below 16 have their
+// own buckets and above that the 3 bits after the highest one are kept
+static int i2c_hist_bucket(unsigned long us)
+{
+  int e = 0;
+  int b;
+
+  if( us < ( 2 << I2CSUBBITS ) ) return us;
+
+  while( ( us >> e ) >= ( 2 << I2CSUBBITS ) ) e++;
+  b = ( 2 << I2CSUBBITS ) + ( e - 1 ) * ( 1 << I2CSUBBITS ) + (int)( us >> e ) - ( 1 << I2CSUBBITS );
+
+  return ( b < I2CHISTMAX ) ? b : I2CHISTMAX - 1;
+}
+
+// lowest time in microseconds counted to bucket
+static unsigned long i2c_hist_low(int b)
+{
+  int e;
+
+  if( b < ( 2 << I2CSUBBITS ) ) return b;
+
+  e = ( b - ( 2 << I2CSUBBITS ) ) / ( 1 << I2CSUBBITS ) + 1;
+
+  return (unsigned long)( ( b - ( 2 << I2CSUBBITS ) ) % ( 1 << I2CSUBBITS ) + ( 1 << I2CSUBBITS ) ) << e;
+}
+
+// time in microseconds below which fraction q of the recorded times are
+static unsigned long i2c_hist_quantile(const struct i2c_hist *h, double q)
+{
+  unsigned long n = 0;
+  int b;
+
+  for( b = 0; b < I2CHISTMAX; b++ )
+  {
+    n += h->bucket[ b ];
+    if( n > 0 && n >= q * h->count ) break;
+  }
+  if( b >= I2CHISTMAX ) return h->max;
+
+  return ( i2c_hist_low( b + 1 ) - 1 < h->max ) ? i2c_hist_low( b + 1 ) - 1 : h->max;
+}
+
+// find counters for address and command, new ones are added while there
+// is space in the table
+static struct i2c_stat *i2c_stats_find(int addr, int cmd)
+{
+  int i;
+
+  for( i = 0; i < nstats; i++ )
+  {
+    if( stats[ i ].addr == addr && stats[ i ].cmd == cmd ) return &stats[ i ];
+  }
+  if( nstats >= I2CSTATMAX ) return NULL;
+
+  memset( &stats[ nstats ], 0, sizeof(struct i2c_stat) );
+  stats[ nstats ].addr = addr;
+  stats[ nstats ].cmd = cmd;
+
+  return &stats[ nstats++ ];
+}
+
+// record one transaction or lock wait with result ok from i2c_session_*()
+void i2c_stats_add(int addr, int cmd, int ok, double seconds)
+{
+  struct i2c_stat *s;
+  unsigned long us;
+
+  s = i2c_stats_find( addr, cmd );
+  if( s == NULL ) return;
+
+  if( ok != 1 )
+  {
+    if( ok >= -4 && ok <= -1 ) s->err[ -ok - 1 ]++;
+    else s->err[ 3 ]++;
+    return;
+  }
+
+  us = ( seconds > 0 ) ? (unsigned long)( 1e6 * seconds ) : 0;
+  s->hist.count++;
+  s->hist.sum += us;
+  if( us > s->hist.max ) s->hist.max = us;
+  s->hist.bucket[ i2c_hist_bucket( us ) ]++;
+}
+
+// print one line for each address and command with the count, failures
+// and percentiles in microseconds followed by the non-empty buckets as
+// lowest time:count
+void i2c_stats_print(FILE *f)
+{
+  int i, b;
+  struct i2c_stat *s;
+
+  fprintf( f, "addr cmd  count     err -1/-2/-3/-4     mean      p50      p90      p99      max\n" );
+  for( i = 0; i < nstats; i++ )
+  {
+    s = &stats[ i ];
+    if( s->cmd == I2CSTAT_LOCK ) fprintf( f, "0x%02x lock", s->addr );
+    else fprintf( f, "0x%02x 0x%02x", s->addr, s->cmd );
+    fprintf( f, " %8lu %5lu/%lu/%lu/%lu", s->hist.count, s->err[ 0 ], s->err[ 1 ], s->err[ 2 ], s->err[ 3 ] );
+    if( s->hist.count > 0 )
+    {
+      fprintf( f, " %8llu %8lu %8lu %8lu %8lu", s->hist.sum / s->hist.count,
+               i2c_hist_quantile( &s->hist, 0.5 ), i2c_hist_quantile( &s->hist, 0.9 ),
+               i2c_hist_quantile( &s->hist, 0.99 ), s->hist.max );
+    }
+    fprintf( f, "\n" );
+
+    if( s->hist.count > 0 )
+    {
+      fprintf( f, "    " );
+      for( b = 0; b < I2CHISTMAX; b++ )
+      {
+        if( s->hist.bucket[ b ] > 0 ) fprintf( f, " %lu:%u", i2c_hist_low( b ), s->hist.bucket[ b ] );
+      }
+      fprintf( f, "\n" );
+    }
+  }
+}
+
+// write statistics to file
+// return: 1=ok, -1=file could not be written
+int i2c_stats_dump(const char *path)
+{
+  FILE *f;
+
+  f = fopen( path, "w" );
+  if( f == NULL )
+  {
+    syslog( LOG_ERR, "Could not write i2c statistics to %s", path );
+    return -1;
+  }
+  i2c_stats_print( f );
+  fclose( f );
+
+  return 1;
+}
+
+// open unix stream socket where each connection gets the statistics
+// return: listening socket, -1=failed
+int i2c_stats_listen(const char *path)
+{
+  int fd;
+  struct sockaddr_un addr;
+
+  fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+  if( fd < 0 ) return -1;
+
+  memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+  strncpy( addr.sun_path, path, sizeof(addr.sun_path) - 1 );
+  unlink( path );
+
+  if( bind( fd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 || listen( fd, 4 ) < 0 )
+  {
+    syslog( LOG_ERR, "Could not open i2c statistics socket %s", path );
+    close( fd );
+    return -1;
+  }
+  chmod( path, 0660 );
+
+  return fd;
+}
+
+// accept connection to statistics socket, write the statistics and close,
+// the text is sent with MSG_NOSIGNAL so a client leaving early does not
+// stop the daemon with SIGPIPE
+void i2c_stats_serve(int sockfd)
+{
+  int fd;
+  FILE *f;
+  char *text = NULL;
+  size_t len = 0;
+
+  fd = accept( sockfd, NULL, NULL );
+  if( fd < 0 ) return;
+
+  f = open_memstream( &text, &len );
+  if( f != NULL )
+  {
+    i2c_stats_print( f );
+    fclose( f );
+    if( send( fd, text, len, MSG_NOSIGNAL ) != (ssize_t)len ) syslog( LOG_NOTICE, "Sending i2c statistics failed" );
+    free( text );
+  }
+  close( fd );
+}
@@ -0,0 +1,28 @@
+#ifndef I2CSTATS_H_INCLUDED
+#define I2CSTATS_H_INCLUDED
+#include <stdio.h>
+#define I2CSTATMAX 64 // maximum number of address and command pairs counted
+#define I2CSUBBITS 3 // 8 histogram buckets for each power of two
+#define I2CHISTMAX 200 // histogram buckets, covers 0 us - 134 s
+#define I2CSTAT_LOCK -1 // command number used for lock wait times
+struct i2c_hist
+{
+  unsigned long count; // number of recorded times
+  unsigned long long sum; // sum of times [us]
+  unsigned long max; // longest time [us]
+  unsigned int bucket[ I2CHISTMAX ]; // log-linear buckets
+};
+struct i2c_stat
+{
+  int addr; // i2c slave address
+  int cmd; // command byte or I2CSTAT_LOCK
+  unsigned long err[ 4 ]; // failures with return value -1, -2, -3 and -4
+  struct i2c_hist hist; // successful transaction or lock times
+};
+double i2c_stats_now(void);
+void i2c_stats_add(int addr, int cmd, int ok, double seconds);
+void i2c_stats_print(FILE *f);
+int i2c_stats_dump(const char *path);
+int i2c_stats_listen(const char *path);
+void i2c_stats_serve(int sockfd);
+#endif
@@ -0,0 +1,113 @@
+#include "picclock.h"
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <syslog.h>
+
+// the PIC counter cycle length is estimated with a scalar Kalman filter,
+// each measurement is the time between two counter readings divided by
+// the number of cycles, its variance comes from not knowing where inside
+// a cycle each reading was taken and the estimate is let to drift with
+// time between the readings
+
+// start from the configured cycle length or the one saved to file
+void picclock_init(struct picclock *pc, double cycle, const char *file)
+{
+  FILE *f;
+  double c, v;
+
+  memset( pc, 0, sizeof(struct picclock) );
+  pc->cycle = cycle;
+  pc->var = 0.05 * cycle * 0.05 * cycle;
+  pc->t = -1;
+  pc->file = file;
+
+  if( file == NULL ) return;
+
+  f = fopen( file, "r" );
+  if( f == NULL ) return;
+
+  if( fscanf( f, "%lf %lf", &c, &v ) == 2 && c > 0.5 * cycle && c < 2 * cycle && v > 0 )
+  {
+    pc->cycle = c;
+// the oscillator may have drifted while not running
+    pc->var = ( v > 0.005 * c * 0.005 * c ) ? v : 0.005 * c * 0.005 * c;
+    syslog( LOG_INFO, "Saved PIC cycle %.6f s from %s", c, file );
+  }
+  fclose( f );
+  pc->saved = pc->cycle;
+}
+
+// forget the reference reading after the counter was reset
+void picclock_reset(struct picclock *pc)
+{
+  pc->t = -1;
+}
+
+// write estimate to file
+static void picclock_save(struct picclock *pc)
+{
+  FILE *f;
+
+  if( pc->file == NULL ) return;
+
+  f = fopen( pc->file, "w" );
+  if( f == NULL )
+  {
+    syslog( LOG_ERR, "Could not write PIC cycle to %s", pc->file );
+    pc->file = NULL;
+    return;
+  }
+  fprintf( f, "%.9f %.6e\n", pc->cycle, pc->var );
+  fclose( f );
+  pc->saved = pc->cycle;
+}
+
+// use counter reading taken at monotonic time t, readings closer than
+// CLOCKMINCYCLES to the reference are skipped and a reading far from the
+// estimate starts a new reference since the counter was probably reset
+// return: 1=estimate updated, 0=no update
+int picclock_sample(struct picclock *pc, int count, double t)
+{
+  int dn;
+  double dt, z, r, k;
+
+  if( count < 0 ) return 0;
+
+  if( pc->t < 0 )
+  {
+    pc->t = t;
+    pc->count = count;
+    return 0;
+  }
+
+  dn = count - pc->count;
+  dt = t - pc->t;
+  if( dn >= 0 && dn < CLOCKMINCYCLES && dt < 2 * CLOCKMINCYCLES * pc->cycle ) return 0;
+
+  if( dn < CLOCKMINCYCLES || fabs( dt / dn - pc->cycle ) > 0.2 * pc->cycle )
+  {
+    syslog( LOG_NOTICE, "PIC counter %d after %d in %.1f s, new reference", count, pc->count, dt );
+    pc->t = t;
+    pc->count = count;
+    return 0;
+  }
+
+  pc->var += CLOCKDRIFT * pc->cycle * CLOCKDRIFT * pc->cycle * dt / 86400;
+
+  z = dt / dn;
+  r = pc->cycle * pc->cycle / ( 6.0 * dn * dn );
+  k = pc->var / ( pc->var + r );
+  pc->cycle += k * ( z - pc->cycle );
+  pc->var *= ( 1 - k );
+  pc->n++;
+
+  pc->t = t;
+  pc->count = count;
+
+  syslog( LOG_DEBUG, "PIC cycle %.6f s +- %.6f s from %d cycles in %.1f s", pc->cycle, sqrt( pc->var ), dn, dt );
+
+  if( fabs( pc->cycle - pc->saved ) > 1e-4 * pc->cycle ) picclock_save( pc );
+
+  return 1;
+}
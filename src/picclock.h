@@ -0,0 +1,18 @@
+#ifndef PICCLOCK_H_INCLUDED
+#define PICCLOCK_H_INCLUDED
+#define CLOCKMINCYCLES 64 // minimum counter cycles between used readings
+#define CLOCKDRIFT 0.01 // expected drift of cycle length in one day
+struct picclock
+{
+  double cycle; // estimated counter cycle length [s]
+  double var; // variance of estimate [s^2]
+  double t; // monotonic time of reference reading [s], <0=none
+  int count; // counter at reference reading
+  double saved; // cycle length last written to file
+  int n; // number of intervals used
+  const char *file; // file keeping the estimate over restarts or NULL
+};
+void picclock_init(struct picclock *pc, double cycle, const char *file);
+void picclock_reset(struct picclock *pc);
+int picclock_sample(struct picclock *pc, int count, double t);
+#endif
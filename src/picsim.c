@@ -0,0 +1,397 @@
+#include "picsim.h"
+#include <string.h>
+#include <stdlib.h>
+
+// model of the PiPIC firmware asm/pic12si2c.asm on 12f675, the data memory
+// uses the same addresses as the firmware so that command 0x01 and reading
+// past the transmit buffer give the same bytes as from the real PIC
+
+// special function registers
+#define GPIO 0x05
+#define TMR1L 0x0E
+#define TMR1H 0x0F
+#define ADRESH 0x1E
+#define ADCON0 0x1F
+#define TRISIO 0x85
+#define IOC 0x96
+#define ADRESL 0x9E
+
+// EEPROM configuration bytes
+#define ini_GPIO 0x11
+#define ini_TRISIO 0x15
+#define ini_IOC 0x17
+#define i2caddr 0x20
+#define inievent 0x21
+#define inie0cmd1 0x22
+
+// variables in ram
+#define time1 0x23
+#define task1 0x27
+#define task2 0x30
+#define event 0x3B
+#define eventreg 0x3C
+#define event0cmd1 0x3D
+#define i2caddram 0x49
+#define i2ctxptr 0x4C
+#define i2ctx1 0x57
+#define i2crec1 0x5B
+
+// offsets in task block
+#define TM1 1
+#define CMD1 4
+#define CMD2 5
+#define CNT1 6
+
+#define TACTIVE 7
+#define TRENABLE 7
+
+// general purpose registers 0x20-0x5F are the same in both banks
+static int ramaddr(int a)
+{
+  a &= 0xFF;
+  if( a >= 0xA0 && a <= 0xDF ) a -= 0x80;
+  return a;
+}
+
+// GPIO as read by the PIC, outputs from the latch and inputs from the pins
+static int gpio_read(struct picsim *pic)
+{
+  int tris = pic->ram[ TRISIO ];
+
+  return ( ( pic->ram[ GPIO ] & ~tris ) | ( pic->pins & tris ) ) & 0x3F;
+}
+
+// memory read with GPIO giving the pin levels
+static int mem_read(struct picsim *pic, int a)
+{
+  a = ramaddr( a );
+  if( a == GPIO ) return gpio_read( pic );
+  return pic->ram[ a ];
+}
+
+// set or clear one GPIO bit, bcf and bsf read the pins before writing
+static void gpio_bit(struct picsim *pic, int bit, int set)
+{
+  int g = gpio_read( pic );
+
+  if( set ) g |= 1 << bit;
+  else g &= ~( 1 << bit );
+  pic->ram[ GPIO ] = g;
+}
+
+// execute GPIO command of timed or event task, return 1 if done
+static int dotask(struct picsim *pic, int cmd1, int cmd2)
+{
+  switch( cmd1 )
+  {
+    case 0x10: gpio_bit( pic, 0, 0 ); break;
+    case 0x20: gpio_bit( pic, 0, 1 ); break;
+    case 0x11: gpio_bit( pic, 1, 0 ); break;
+    case 0x21: gpio_bit( pic, 1, 1 ); break;
+    case 0x14: gpio_bit( pic, 4, 0 ); break;
+    case 0x24: gpio_bit( pic, 4, 1 ); break;
+    case 0x15: gpio_bit( pic, 5, 0 ); break;
+    case 0x25: gpio_bit( pic, 5, 1 ); break;
+    case 0x30: pic->ram[ GPIO ] = cmd2; break;
+    case 0x31: pic->ram[ TRISIO ] = cmd2; break;
+    case 0x32: pic->ram[ GPIO ] = gpio_read( pic ) & cmd2; break;
+    case 0x33: pic->ram[ GPIO ] = gpio_read( pic ) | cmd2; break;
+    case 0x34: pic->ram[ GPIO ] = gpio_read( pic ) ^ cmd2; break;
+    default: return 0;
+  }
+  return 1;
+}
+
+// count down timed task and execute it when the counter goes below zero
+static void nxtask(struct picsim *pic, int task)
+{
+  unsigned char *t = &pic->ram[ task ];
+  int cnt;
+
+  if( ( t[ 0 ] & ( 1 << TACTIVE ) ) == 0 ) return;
+
+  cnt = 65536 * t[ CNT1 ] + 256 * t[ CNT1 + 1 ] + t[ CNT1 + 2 ] - 1;
+  if( cnt >= 0 )
+  {
+    t[ CNT1 ] = cnt >> 16;
+    t[ CNT1 + 1 ] = cnt >> 8;
+    t[ CNT1 + 2 ] = cnt;
+    return;
+  }
+
+  dotask( pic, t[ CMD1 ], t[ CMD2 ] );
+  memcpy( &t[ CNT1 ], &t[ TM1 ], 3 );
+  t[ 0 ]--; // repeat count, clears TACTIVE after the last round
+}
+
+// advance internal timer by one cycle
+static void nxtime(struct picsim *pic)
+{
+  int i;
+
+  for( i = 3; i >= 0; i-- )
+  {
+    pic->ram[ time1 + i ]++;
+    if( pic->ram[ time1 + i ] != 0 ) break;
+  }
+  nxtask( pic, task1 );
+  nxtask( pic, task2 );
+}
+
+// initialize PIC in power on state with erased EEPROM
+void picsim_init(struct picsim *pic, int addr, double now)
+{
+  memset( pic->ram, 0, sizeof(pic->ram) );
+  memset( pic->eeprom, 0xFF, sizeof(pic->eeprom) );
+  pic->eeprom[ i2caddr ] = addr;
+  pic->addr = addr;
+  pic->pins = 0x3F;
+  pic->adc[ 0 ] = pic->adc[ 1 ] = pic->adc[ 2 ] = pic->adc[ 3 ] = 512;
+  pic->adcnoise = 0;
+  pic->cycle = 0.524288;
+  pic->tlast = now;
+  pic->motor = 0;
+  pic->mpos = 512;
+  pic->tmotor = now;
+  picsim_setup( pic );
+}
+
+// firmware setup from EEPROM as after power on or command 0x06C5, the
+// internal timer is not touched
+void picsim_setup(struct picsim *pic)
+{
+  int i;
+  unsigned char *ee = pic->eeprom;
+
+  pic->ram[ GPIO ] = ~ee[ ini_GPIO ] & 0x3F;
+  pic->ram[ TMR1L ] = pic->ram[ TMR1H ] = 0;
+  pic->ram[ TRISIO ] = ( ee[ ini_TRISIO ] | 0x0C ) & 0x3F;
+  pic->ram[ IOC ] = ~ee[ ini_IOC ] & 0x3F;
+
+  memset( &pic->ram[ i2crec1 ], 0, 3 );
+  pic->ram[ i2ctxptr ] = i2ctx1;
+  pic->ram[ i2ctx1 ] = 0xC5;
+  pic->ram[ i2ctx1 + 1 ] = 0x5C;
+
+  pic->ram[ task1 ] = 0;
+  pic->ram[ task2 ] = 0;
+
+  pic->ram[ event ] = 0;
+  pic->ram[ eventreg ] = ( ee[ inievent ] == 0x80 ) ? 0x80 : 0x00;
+  for( i = 0; i < 10; i++ ) pic->ram[ event0cmd1 + i ] = ee[ inie0cmd1 + i ];
+
+  pic->ram[ i2caddram ] = ( ee[ i2caddr ] & 0x80 ) ? 0x4C : ( ee[ i2caddr ] << 1 );
+}
+
+// H-bridge motor turning the position potentiometer on AN0, GP5 alone
+// increases and GP4 alone decreases the position
+static void motor(struct picsim *pic, double now)
+{
+  int g = pic->ram[ GPIO ] & 0x30;
+  double dt = now - pic->tmotor;
+
+  pic->tmotor = now;
+  if( pic->motor <= 0 || dt <= 0 ) return;
+
+  if( g == 0x20 ) pic->mpos += pic->motor * dt;
+  else if( g == 0x10 ) pic->mpos -= pic->motor * dt;
+  if( pic->mpos < 0 ) pic->mpos = 0;
+  if( pic->mpos > 1023 ) pic->mpos = 1023;
+  pic->adc[ 0 ] = (int)( pic->mpos + 0.5 );
+}
+
+// run internal timer cycles up to given time [s], after a long pause only
+// the counter is advanced without running the tasks for each cycle
+void picsim_update(struct picsim *pic, double now)
+{
+  long n;
+  unsigned int t;
+  double frac;
+
+  motor( pic, now );
+
+  if( pic->cycle <= 0 || now < pic->tlast ) return;
+
+  n = (long)( ( now - pic->tlast ) / pic->cycle );
+  pic->tlast += n * pic->cycle;
+
+  if( n > 100000 )
+  {
+    t = 16777216U * pic->ram[ time1 ] + 65536 * pic->ram[ time1 + 1 ] + 256 * pic->ram[ time1 + 2 ] + pic->ram[ time1 + 3 ];
+    t += n - 100000;
+    pic->ram[ time1 ] = t >> 24;
+    pic->ram[ time1 + 1 ] = t >> 16;
+    pic->ram[ time1 + 2 ] = t >> 8;
+    pic->ram[ time1 + 3 ] = t;
+    n = 100000;
+  }
+  while( n-- > 0 ) nxtime( pic );
+
+  frac = ( now - pic->tlast ) / pic->cycle;
+  t = (unsigned int)( frac * 65536 );
+  pic->ram[ TMR1H ] = t >> 8;
+  pic->ram[ TMR1L ] = t;
+}
+
+// one A/D reading with random noise
+static int adread(struct picsim *pic, int ch)
+{
+  int v = pic->adc[ ch ];
+
+  if( pic->adcnoise > 0 ) v += rand() % ( 2 * pic->adcnoise + 1 ) - pic->adcnoise;
+  if( v < 0 ) v = 0;
+  if( v > 1023 ) v = 1023;
+
+  pic->ram[ ADCON0 ] = 0x81 | ( ch << 2 );
+  pic->ram[ ADRESH ] = v >> 8;
+  pic->ram[ ADRESL ] = v;
+
+  return v;
+}
+
+// A/D conversion right justified to ADRESH:ADRESL
+static void adconv(struct picsim *pic, int ch)
+{
+  int v = adread( pic, ch );
+
+  pic->ram[ i2ctx1 ] = v >> 8;
+  pic->ram[ i2ctx1 + 1 ] = v;
+}
+
+// n conversions summed with minimum and maximum as command 0x44, the
+// reply continues over the receive buffer
+static void adcsum(struct picsim *pic, int ch, int n)
+{
+  int i, v = 0, sum = 0, min = 0x3FF, max = 0;
+  unsigned char *tx = &pic->ram[ i2ctx1 ];
+
+  if( n == 0 ) n = 64;
+  for( i = 0; i < n; i++ )
+  {
+    v = adread( pic, ch );
+    sum += v;
+    if( v < min ) min = v;
+    if( v > max ) max = v;
+  }
+
+  tx[ 0 ] = sum >> 8;
+  tx[ 1 ] = sum;
+  tx[ 2 ] = min >> 8;
+  tx[ 3 ] = min;
+  tx[ 4 ] = max >> 8;
+  tx[ 5 ] = max;
+  tx[ 6 ] = 0;
+  tx[ 7 ] = v;
+  tx[ 8 ] = v >> 8;
+}
+
+// command in receive buffer executed after the stop bit
+static void i2cmd(struct picsim *pic)
+{
+  unsigned char *rec = &pic->ram[ i2crec1 ];
+  unsigned char *tx = &pic->ram[ i2ctx1 ];
+  int i, a;
+
+  pic->ram[ i2ctxptr ] = i2ctx1;
+
+  if( dotask( pic, rec[ 0 ], rec[ 1 ] ) ) return;
+
+  switch( rec[ 0 ] )
+  {
+    case 0x01: tx[ 0 ] = mem_read( pic, rec[ 1 ] ); break;
+    case 0x02: memcpy( tx, &rec[ 1 ], 4 ); break;
+    case 0x03: tx[ 0 ] = pic->eeprom[ rec[ 1 ] & 0x7F ]; break;
+    case 0x04: pic->eeprom[ rec[ 1 ] & 0x7F ] = rec[ 2 ]; break;
+    case 0x05: tx[ 0 ] = pic->ram[ TMR1H ]; tx[ 1 ] = pic->ram[ TMR1L ]; break;
+    case 0x06: if( rec[ 1 ] == 0xC5 ) picsim_setup( pic ); break;
+    case 0x07: pic->ram[ i2ctxptr ] = rec[ 1 ]; break;
+    case 0x08:
+      // the copy overwrites the receive buffer
+      a = rec[ 1 ];
+      for( i = 0; i < 8; i++ ) tx[ i ] = pic->eeprom[ ( a + i ) & 0x7F ];
+      break;
+    case 0x40: adconv( pic, 0 ); break;
+    case 0x41: adconv( pic, 1 ); break;
+    case 0x43: adconv( pic, 3 ); break;
+    case 0x44: adcsum( pic, rec[ 1 ] & 0x03, rec[ 2 ] & 0x3F ); break;
+    case 0x50: memset( &pic->ram[ time1 ], 0, 4 ); break;
+    case 0x51: memcpy( tx, &pic->ram[ time1 ], 4 ); break;
+    case 0x60: pic->ram[ task1 ] &= ~( 1 << TACTIVE ); break;
+    case 0x61:
+      pic->ram[ task1 ] |= 1 << TACTIVE;
+      memcpy( &pic->ram[ task1 + CNT1 ], &pic->ram[ task1 + TM1 ], 3 );
+      break;
+    case 0x62: memcpy( &pic->ram[ task1 + TM1 ], &rec[ 2 ], 3 ); break;
+    case 0x63: memcpy( &pic->ram[ task1 + CMD1 ], &rec[ 1 ], 2 ); break;
+    case 0x64: pic->ram[ task1 ] = ( pic->ram[ task1 ] & 0x80 ) | rec[ 1 ]; break;
+    case 0x70: pic->ram[ task2 ] &= ~( 1 << TACTIVE ); break;
+    case 0x71:
+      pic->ram[ task2 ] |= 1 << TACTIVE;
+      memcpy( &pic->ram[ task2 + CNT1 ], &pic->ram[ task2 + TM1 ], 3 );
+      break;
+    case 0x72: memcpy( &pic->ram[ task2 + TM1 ], &rec[ 2 ], 3 ); break;
+    case 0x73: memcpy( &pic->ram[ task2 + CMD1 ], &rec[ 1 ], 2 ); break;
+    case 0x74: pic->ram[ task2 ] = ( pic->ram[ task2 ] & 0x80 ) | rec[ 1 ]; break;
+    case 0xA0: pic->ram[ eventreg ] &= ~( 1 << TRENABLE ); break;
+    case 0xA1: pic->ram[ eventreg ] |= 1 << TRENABLE; pic->ram[ event ] = 0; break;
+    case 0xA2: tx[ 0 ] = pic->ram[ eventreg ]; break;
+    case 0xA3: pic->ram[ eventreg ] &= 1 << TRENABLE; break;
+    case 0xA4: case 0xA5: case 0xA6: case 0xA7: case 0xA8:
+      memcpy( &pic->ram[ event0cmd1 + 2 * ( rec[ 0 ] - 0xA4 ) ], &rec[ 1 ], 2 );
+      break;
+  }
+}
+
+// write transfer from master, the bytes go to the five byte receive buffer
+// and the command is executed after the stop bit
+// return: 1=ok, 0=empty write
+int picsim_write(struct picsim *pic, const unsigned char *buf, int length)
+{
+  int i;
+
+  if( length < 1 ) return 0;
+
+  for( i = 0; i < length && i < 5; i++ ) pic->ram[ i2crec1 + i ] = buf[ i ];
+  i2cmd( pic );
+
+  return 1;
+}
+
+// read transfer from master, bytes are sent from the transmit buffer, or
+// the address set with command 0x07, and the following memory as long as
+// the master acknowledges
+// return: 1=ok
+int picsim_read(struct picsim *pic, unsigned char *buf, int length)
+{
+  int i;
+
+  for( i = 0; i < length; i++ ) buf[ i ] = mem_read( pic, pic->ram[ i2ctxptr ] + i );
+
+  return 1;
+}
+
+// change level on input pin, going to zero on pin with interrupt on change
+// sets the event register and runs the event task if enabled
+void picsim_pin(struct picsim *pic, int pin, int level)
+{
+  int trg, i;
+  const int bits[ 4 ] = { 0, 1, 4, 5 };
+
+  if( level ) pic->pins |= 1 << pin;
+  else pic->pins &= ~( 1 << pin );
+
+  trg = ( gpio_read( pic ) & pic->ram[ IOC ] ) ^ pic->ram[ IOC ];
+  pic->ram[ event ] |= trg;
+  pic->ram[ eventreg ] |= trg;
+
+  if( ( pic->ram[ eventreg ] & ( 1 << TRENABLE ) ) == 0 ) return;
+
+  for( i = 0; i < 4; i++ )
+  {
+    if( pic->ram[ event ] & ( 1 << bits[ i ] ) )
+    {
+      pic->ram[ event ] &= ~( 1 << bits[ i ] );
+      dotask( pic, pic->ram[ event0cmd1 + 2 * i ], pic->ram[ event0cmd1 + 2 * i + 1 ] );
+    }
+  }
+}
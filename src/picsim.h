@@ -0,0 +1,23 @@
+#ifndef PICSIM_H_INCLUDED
+#define PICSIM_H_INCLUDED
+struct picsim
+{
+  int addr; // i2c slave address
+  unsigned char ram[ 256 ]; // data memory with special function registers
+  unsigned char eeprom[ 128 ]; // data EEPROM
+  unsigned char pins; // external level on input pins GP0-GP5
+  int adc[ 4 ]; // A/D reading on AN0-AN3 (0-1023)
+  int adcnoise; // maximum random error added to A/D reading
+  double cycle; // internal timer cycle [s]
+  double tlast; // time of last timer cycle [s]
+  double motor; // AN0 change rate with H-bridge motor on GP4 and GP5 [1/s]
+  double mpos; // motor position on AN0
+  double tmotor; // time of last motor update [s]
+};
+void picsim_init(struct picsim *pic, int addr, double now);
+void picsim_setup(struct picsim *pic);
+void picsim_update(struct picsim *pic, double now);
+int picsim_write(struct picsim *pic, const unsigned char *buf, int length);
+int picsim_read(struct picsim *pic, unsigned char *buf, int length);
+void picsim_pin(struct picsim *pic, int pin, int level);
+#endif
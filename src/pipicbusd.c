@@ -0,0 +1,542 @@
+/**************************************************************************
+ *
+ * Own the i2c bus on Raspberry Pi and serve transfers to all PiPIC
+ * processors for the daemons pipicpowerd, pipicswd and pipichbd. The
+ * transfers are queued by priority so that button polling and motor stop
+ * commands go before bulk memory reads.
+ *
+ * Copyright (C) 2014 - 2021 Jaakko Koivuniemi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************
+ *
+ * Sat Oct 17 10:12:40 CDT 2026
+ *
+ * Jaakko Koivuniemi
+ **/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include "pipicbusd.h"
+#include "i2csession.h"
+#include "i2cstats.h"
+#include "busproto.h"
+
+#define MAXCLIENTS 16 // maximum number of connected daemons
+#define MAXADDR 128 // number of 7-bit i2c addresses
+
+const int version = 20261017; // program version
+
+const char *i2cdev = "/dev/i2c-1"; // i2c device file
+const int address = 0x00; // not used, each client gives the slave address
+const int i2lockmax = 10; // maximum number of times to try lock i2c port
+int rdwr = 0; // 1=command and reply as one I2C_RDWR with repeated start
+int holdmax = 2000; // maximum time one client can reserve an address [ms]
+
+const char confile[ 200 ] = "/etc/pipicbusd_config";
+
+const char pidfile[ 200 ] = "/run/pipicbusd.pid";
+const char statsfile[ 200 ] = "/run/pipicbusd.i2cstats"; // written on SIGUSR1
+const char statsock[ 200 ] = "/run/pipicbusd-i2c.sock"; // i2c statistics socket
+
+int loglev = 5;
+char message[ 200 ] = "";
+
+struct busclient
+{
+  int fd; // connected socket or -1
+  int pending; // 1=request waiting in queue
+  int prio; // priority of pending request
+  unsigned long seq; // arrival order of pending request
+  struct busreq req; // pending request
+};
+
+struct busclient clients[ MAXCLIENTS ];
+
+struct i2c_session bus[ MAXADDR ]; // open i2c device for each slave address
+int holder[ MAXADDR ]; // client reserving the address or -1
+long holdtime[ MAXADDR ]; // time of reservation [ms]
+
+unsigned long reqseq = 0; // request counter
+
+// read configuration file if it exists
+void read_config()
+{
+  FILE *cfile;
+  char *line = NULL;
+  char par[ 20 ];
+  float value;
+  size_t len;
+  ssize_t read;
+
+  cfile = fopen( confile, "r" );
+  if( NULL != cfile )
+  {
+    syslog( LOG_INFO | LOG_DAEMON, "Read configuration file" );
+
+    while( ( read = getline( &line, &len, cfile ) ) != -1 )
+    {
+       if( sscanf( line, "%s %f", par, &value ) != EOF )
+       {
+          if( strncmp( par, "LOGLEVEL", 8 ) == 0 )
+          {
+             loglev = (int)value;
+             sprintf( message, "Log level set to %d", (int)value );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+             setlogmask( LOG_UPTO (loglev) );
+          }
+          if( strncmp( par, "I2CRDWR", 7 ) == 0 )
+          {
+             rdwr = (int)value;
+             if( rdwr == 1 ) syslog( LOG_INFO | LOG_DAEMON, "Combined i2c command and reply with repeated start" );
+          }
+          if( strncmp( par, "HOLDMAX", 7 ) == 0 )
+          {
+             holdmax = (int)value;
+             sprintf( message, "Maximum address reservation %d ms", holdmax );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+          }
+       }
+    }
+    fclose( cfile );
+  }
+  else
+  {
+    sprintf( message, "Could not open %s", confile );
+    syslog( LOG_ERR | LOG_DAEMON, "%s", message );
+  }
+}
+
+// monotonic time in milliseconds
+long millis()
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// priority of request from the command byte if the client did not give it,
+// event register reads (button), GPIO set/clear and direct GPIO writes
+// (motor stop) and task cancels are urgent, RAM and EEPROM reads are bulk
+int bus_priority(const struct busreq *req)
+{
+  int cmd;
+
+  if( req->prio >= BUSPRIO_BULK && req->prio <= BUSPRIO_URGENT ) return req->prio;
+  if( req->wlength == 0 ) return BUSPRIO_NORMAL;
+
+  cmd = req->wbuf[ 0 ];
+  if( cmd == 0xA2 || ( cmd >= 0x10 && cmd <= 0x34 ) || cmd == 0x60 || cmd == 0x70 ) return BUSPRIO_URGENT;
+  if( cmd == 0x01 || cmd == 0x03 || cmd == 0x07 || cmd == 0x08 ) return BUSPRIO_BULK;
+
+  return BUSPRIO_NORMAL;
+}
+
+// release all addresses reserved by client
+void release_all(int c)
+{
+  int a;
+
+  for( a = 0; a < MAXADDR; a++ )
+  {
+    if( holder[ a ] == c ) holder[ a ] = -1;
+  }
+}
+
+// disconnect client and drop its pending request and reservations
+void drop_client(int c)
+{
+  sprintf( message, "Client %d disconnected", c );
+  syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+
+  close( clients[ c ].fd );
+  clients[ c ].fd = -1;
+  clients[ c ].pending = 0;
+  release_all( c );
+}
+
+// accept new client
+void accept_client(int sockfd)
+{
+  int fd, c;
+
+  fd = accept( sockfd, NULL, NULL );
+  if( fd < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Socket accept failed" );
+    return;
+  }
+
+  for( c = 0; c < MAXCLIENTS; c++ )
+  {
+    if( clients[ c ].fd < 0 )
+    {
+      clients[ c ].fd = fd;
+      clients[ c ].pending = 0;
+      sprintf( message, "Client %d connected", c );
+      syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+      return;
+    }
+  }
+
+  syslog( LOG_ERR | LOG_DAEMON, "Too many clients, connection refused" );
+  close( fd );
+}
+
+// read request from client to the queue
+void read_request(int c)
+{
+  ssize_t n;
+  struct busreq *req = &clients[ c ].req;
+
+  n = recv( clients[ c ].fd, req, sizeof(struct busreq), 0 );
+  if( n != sizeof(struct busreq) )
+  {
+    drop_client( c );
+    return;
+  }
+
+  clients[ c ].pending = 1;
+  clients[ c ].prio = bus_priority( req );
+  clients[ c ].seq = reqseq++;
+}
+
+// send reply to client
+void send_reply(int c, struct busrep *rep)
+{
+  if( send( clients[ c ].fd, rep, sizeof(struct busrep), MSG_NOSIGNAL ) != sizeof(struct busrep) )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Socket writing failed" );
+    drop_client( c );
+  }
+}
+
+// do the i2c transfer of request, the device for each slave address is
+// opened on first use and locked with flock() only for the transfer so
+// that pipic(1) and other tools can still access the bus
+// return: 1=ok, -1=open failed, -2=lock failed, -3=bus access failed,
+// -4=i2c slave writing or reading failed
+int do_transfer(const struct busreq *req, struct busrep *rep)
+{
+  int ok;
+  struct i2c_session *ses = &bus[ req->addr ];
+
+  if( ses->dev == NULL )
+  {
+    ses->dev = i2cdev;
+    ses->addr = req->addr;
+    ses->lockmax = i2lockmax;
+  }
+  ses->rdwr = rdwr;
+
+  ok = i2c_session_lock( ses );
+  if( ok != 1 ) return ok;
+
+  if( req->wlength > 0 && req->rlength > 0 ) ok = i2c_session_xfer( ses, req->wbuf, req->wlength, rep->rbuf, req->rlength );
+  else if( req->wlength > 0 ) ok = i2c_session_write( ses, req->wbuf, req->wlength );
+  else if( req->rlength > 0 ) ok = i2c_session_read( ses, rep->rbuf, req->rlength );
+
+  i2c_session_unlock( ses );
+
+  if( ok == 1 ) rep->rlength = req->rlength;
+
+  return ok;
+}
+
+// pick the pending request with highest priority, oldest first, skipping
+// addresses reserved by other clients
+// return: client number or -1 if nothing can be done now
+int next_request()
+{
+  int c, a;
+  int best = -1;
+  long now = millis();
+
+  for( c = 0; c < MAXCLIENTS; c++ )
+  {
+    if( clients[ c ].fd < 0 || clients[ c ].pending == 0 ) continue;
+
+    a = clients[ c ].req.addr & 0x7F;
+    if( holder[ a ] >= 0 && holder[ a ] != c )
+    {
+      if( now - holdtime[ a ] < holdmax ) continue;
+      sprintf( message, "Client %d reserved address 0x%02x too long, released", holder[ a ], a );
+      syslog( LOG_WARNING | LOG_DAEMON, "%s", message );
+      holder[ a ] = -1;
+    }
+
+    if( best < 0 || clients[ c ].prio > clients[ best ].prio ||
+      ( clients[ c ].prio == clients[ best ].prio && clients[ c ].seq < clients[ best ].seq ) ) best = c;
+  }
+
+  return best;
+}
+
+// serve one queued request
+void serve_request(int c)
+{
+  struct busreq *req = &clients[ c ].req;
+  struct busrep rep;
+  int a = req->addr & 0x7F;
+
+  memset( &rep, 0, sizeof(rep) );
+  clients[ c ].pending = 0;
+
+  if( req->flags & BUS_RELEASE )
+  {
+    if( holder[ a ] == c ) holder[ a ] = -1;
+    rep.status = 1;
+  }
+  else if( req->addr > 0x77 || req->wlength > BUSMAXDATA || req->rlength > BUSMAXDATA )
+  {
+    sprintf( message, "Invalid request from client %d", c );
+    syslog( LOG_ERR | LOG_DAEMON, "%s", message );
+    rep.status = -4;
+  }
+  else
+  {
+    rep.status = do_transfer( req, &rep );
+    if( req->flags & BUS_HOLD )
+    {
+      if( holder[ a ] != c ) holdtime[ a ] = millis();
+      holder[ a ] = c;
+    }
+  }
+
+  sprintf( message, "Client %d address 0x%02x priority %d status %d", c, a, clients[ c ].prio, rep.status );
+  syslog( LOG_DEBUG, "%s", message );
+
+  send_reply( c, &rep );
+}
+
+int cont = 1; /* main loop flag */
+
+void stop(int sig)
+{
+  sprintf( message, "signal %d catched, stop", sig );
+  syslog( LOG_NOTICE | LOG_DAEMON, "%s", message );
+  cont = 0;
+}
+
+void hup(int sig)
+{
+  sprintf( message, "signal %d catched", sig );
+  syslog( LOG_NOTICE | LOG_DAEMON, "%s", message );
+}
+
+volatile sig_atomic_t dumpstats = 0; // 1=write i2c statistics to file
+
+// the statistics file is written from the main loop after SIGUSR1
+void usr1(int sig)
+{
+  dumpstats = 1;
+}
+
+int main()
+{
+  int ok = 0;
+  int c, a, n;
+
+  setlogmask( LOG_UPTO (loglev) );
+  syslog( LOG_NOTICE | LOG_DAEMON, "pipicbusd v. %d started", version );
+
+  signal( SIGINT, &stop );
+  signal( SIGTERM, &stop );
+  signal( SIGQUIT, &stop );
+  signal( SIGHUP, &hup );
+  signal( SIGUSR1, &usr1 );
+
+  read_config(); // read configuration file
+
+  for( c = 0; c < MAXCLIENTS; c++ ) clients[ c ].fd = -1;
+  for( a = 0; a < MAXADDR; a++ )
+  {
+    memset( &bus[ a ], 0, sizeof(struct i2c_session) );
+    bus[ a ].fd = -1;
+    holder[ a ] = -1;
+  }
+
+  pid_t pid, sid;
+
+  pid = fork();
+  if( pid < 0 )
+  {
+    exit( EXIT_FAILURE );
+  }
+
+  if( pid > 0 )
+  {
+    exit( EXIT_SUCCESS );
+  }
+
+  umask( 0 );
+
+  /* Create a new SID for the child process */
+  sid = setsid();
+  if( sid < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "failed to create child process" );
+    exit( EXIT_FAILURE );
+  }
+
+  if( chdir( "/" ) < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "failed to change to root directory" );
+    exit( EXIT_FAILURE );
+  }
+
+  /* Close out the standard file descriptors */
+  close( STDIN_FILENO );
+  close( STDOUT_FILENO );
+  close( STDERR_FILENO );
+
+  FILE *pidf;
+  pidf = fopen( pidfile, "w" );
+
+  if( pidf == NULL )
+  {
+    sprintf( message, "Could not open PID lock file %s, exiting", pidfile );
+    syslog( LOG_ERR | LOG_DAEMON, "%s", message );
+    exit( EXIT_FAILURE );
+  }
+
+  if( flock( fileno( pidf ), LOCK_EX | LOCK_NB ) == -1 )
+  {
+    sprintf( message, "Could not lock PID lock file %s, exiting", pidfile );
+    syslog( LOG_ERR | LOG_DAEMON, "%s", message );
+    exit( EXIT_FAILURE );
+  }
+
+  fprintf( pidf, "%d\n", getpid() );
+  fclose( pidf );
+
+// open socket
+  int sockfd;
+  struct sockaddr_un serv_addr;
+
+  sockfd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+  if( sockfd < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Could not open socket" );
+    exit( EXIT_FAILURE );
+  }
+
+  memset( &serv_addr, 0, sizeof(serv_addr) );
+  serv_addr.sun_family = AF_UNIX;
+  strncpy( serv_addr.sun_path, BUSSOCKET, sizeof(serv_addr.sun_path) - 1 );
+  unlink( BUSSOCKET );
+
+  if( bind( sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr) ) < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Could not bind socket" );
+    exit( EXIT_FAILURE );
+  }
+  chmod( BUSSOCKET, 0660 );
+
+  listen( sockfd, MAXCLIENTS );
+  syslog( LOG_NOTICE | LOG_DAEMON, "Listen socket " BUSSOCKET );
+
+  int statfd = i2c_stats_listen( statsock );
+
+// wait for requests, after each transfer new requests are read without
+// waiting so that an urgent one can go before the rest of the queue
+  struct pollfd fds[ MAXCLIENTS + 2 ];
+  int cfd[ MAXCLIENTS + 2 ];
+  int nfds;
+  int next = -1;
+  int waiting = 0;
+
+  while( cont == 1 )
+  {
+    fds[ 0 ].fd = sockfd;
+    fds[ 0 ].events = POLLIN;
+    fds[ 1 ].fd = statfd; // negative descriptor is ignored by poll
+    fds[ 1 ].events = POLLIN;
+    nfds = 2;
+    for( c = 0; c < MAXCLIENTS; c++ )
+    {
+      if( clients[ c ].fd >= 0 && clients[ c ].pending == 0 )
+      {
+        fds[ nfds ].fd = clients[ c ].fd;
+        fds[ nfds ].events = POLLIN;
+        cfd[ nfds ] = c;
+        nfds++;
+      }
+    }
+
+// poll again after 100 ms if requests wait for a reserved address
+    waiting = 0;
+    for( c = 0; c < MAXCLIENTS; c++ ) waiting |= ( clients[ c ].fd >= 0 && clients[ c ].pending );
+    n = poll( fds, nfds, ( next >= 0 ) ? 0 : ( waiting ? 100 : -1 ) );
+    if( n < 0 && errno != EINTR )
+    {
+      syslog( LOG_ERR | LOG_DAEMON, "Socket poll failed" );
+      break;
+    }
+
+    if( n > 0 )
+    {
+      for( c = 2; c < nfds; c++ )
+      {
+        if( fds[ c ].revents & ( POLLIN | POLLHUP | POLLERR ) ) read_request( cfd[ c ] );
+      }
+      if( fds[ 0 ].revents & POLLIN ) accept_client( sockfd );
+      if( fds[ 1 ].revents & POLLIN ) i2c_stats_serve( statfd );
+    }
+
+    if( dumpstats == 1 )
+    {
+      dumpstats = 0;
+      i2c_stats_dump( statsfile );
+    }
+
+    next = next_request();
+    if( next >= 0 ) serve_request( next );
+    next = next_request();
+  }
+
+  for( c = 0; c < MAXCLIENTS; c++ )
+  {
+    if( clients[ c ].fd >= 0 ) close( clients[ c ].fd );
+  }
+  for( a = 0; a < MAXADDR; a++ ) i2c_session_close( &bus[ a ] );
+  close( sockfd );
+  unlink( BUSSOCKET );
+  if( statfd >= 0 )
+  {
+    close( statfd );
+    unlink( statsock );
+  }
+
+  syslog( LOG_NOTICE | LOG_DAEMON, "remove PID file" );
+  ok = remove( pidfile );
+
+  return ok;
+}
@@ -47,6 +47,81 @@ void printversion()
   printf("pipicfile v. 20130811, Jaakko Koivuniemi\n");
 }
 
+// write command with one parameter byte and read reply of given length
+// return: 1=ok, -1=failed
+int readreply(int fd, int cmd, int par, unsigned char *data, int length)
+{
+  unsigned char buf[2];
+
+  buf[0]=cmd;
+  buf[1]=par;
+  if((write(fd, buf, 2)) != 2) 
+  {
+     perror("Error writing to i2c slave");
+     return -1;
+  }
+  if(read(fd, data, length)!=length) 
+  {
+     perror("Unable to read from slave");
+     return -1;
+  }
+  return 1;
+}
+
+// test if firmware has the bulk read commands 0x07 and 0x08, the tx buffer
+// is filled with 0x02 and the read started from the second byte
+// return: 1=bulk read, 0=only single byte reads, -1=failed
+int bulktest(int fd)
+{
+  unsigned char buf[5]={2,0xB1,0x0C,0x00,0x00};
+
+  if((write(fd, buf, 5)) != 5) 
+  {
+     perror("Error writing to i2c slave");
+     return -1;
+  }
+  if(readreply(fd, 7, 0x58, buf, 1)<0) return -1;
+  return (buf[0]==0x0C);
+}
+
+// read data memory from given address with one burst using command 0x07
+// or byte by byte with command 0x01
+// return: 1=ok, -1=failed
+int readmem(int fd, int bulk, int addr, unsigned char *data, int length)
+{
+  int i;
+
+  if(bulk==1) return readreply(fd, 7, addr, data, length);
+
+  for(i=0;i<length;i++)
+  {
+     if(readreply(fd, 1, addr+i, &data[i], 1)<0) return -1;
+  }
+  return 1;
+}
+
+// read EEPROM from given address eight bytes at a time using command 0x08
+// or byte by byte with command 0x03
+// return: 1=ok, -1=failed
+int readeeprom(int fd, int bulk, int addr, unsigned char *data, int length)
+{
+  int i;
+
+  for(i=0;i<length;)
+  {
+     if((bulk==1)&&(length-i>=8))
+     {
+        if(readreply(fd, 8, addr+i, &data[i], 8)<0) return -1;
+        i+=8;
+     }
+     else
+     {
+        if(readreply(fd, 3, addr+i, &data[i], 1)<0) return -1;
+        i++;
+     }
+  }
+  return 1;
+}
 
 int main(int argc, char **argv)
 {  
@@ -58,8 +133,9 @@ int main(int argc, char **argv)
   int  address=0x00;
   int  file=-1;
   unsigned char buf[10];
+  unsigned char mem[256]; // data memory or EEPROM content
+  int bulk=0; // 1=bulk read commands in firmware
   int i=0,j=0;
-  int byte1=0,byte2=0;
   char lascii[17];
   int waddr=0,wbyte=0;
 
@@ -129,198 +205,68 @@ int main(int argc, char **argv)
 
   if((file>=0)&&(file<=255))
   {
-     buf[0]=1;
-     buf[1]=file;
-     if((write(fd, buf, 2)) != 2) 
-     {
-        perror("Error writing to i2c slave");
-        return -1;
-     }
-  
-     if(read(fd, buf,1)!=1) 
-     {
-        perror("Unable to read from slave");
-        return -1;
-     }
-     else 
-     {
-        printf("0x%02x\n",buf[0]); 
-     } 
+     if(readreply(fd, 1, file, buf, 1)<0) return -1;
+     printf("0x%02x\n",buf[0]); 
   }
-  else
+  else if((weeprom==0)||(peeprom==1))
+  {
+     bulk=bulktest(fd);
+     if(bulk<0) return -1;
+     if(verb==1) printf("Bulk read %s\n", (bulk==1) ? "yes" : "no");
+  }
+
+  if((file<0)||(file>255))
   {
      if((verb==1)&&(peeprom==0)&&(weeprom==0))
      {
+        if(readmem(fd, bulk, 0x00, mem, 32)<0) return -1;
+        if(readmem(fd, bulk, 0x80, &mem[0x80], 32)<0) return -1;
+
         for(i=0;i<32;i++)
         {
-           byte1=-1;
-           byte2=-1;
-
-           if(reg0[i][0]!='\00') 
-           {
-             buf[0]=1;
-             buf[1]=i;
-             if((write(fd, buf, 2)) != 2) 
-             {
-                perror("Error writing to i2c slave");
-                return -1;
-             }
-             if(read(fd, buf,1)!=1) 
-             {
-                perror("Unable to read from slave");
-                return -1;
-             }
-             else 
-             {
-                byte1=buf[0];
-             }
-           } 
-           
-           if(reg1[i][0]!='\00') 
-           {
-             buf[0]=1;
-             buf[1]=i+0x80;
-             if((write(fd, buf, 2)) != 2) 
-             {
-                perror("Error writing to i2c slave");
-                return -1;
-             }
-             if(read(fd, buf,1)!=1) 
-             {
-                perror("Unable to read from slave");
-                return -1;
-             }
-             else 
-             {
-                byte2=buf[0];
-             }
-           }
-
-           if((byte1>=0)||(byte2>=0))
+           if((reg0[i][0]!='\00')||(reg1[i][0]!='\00'))
            {                
              printf("0x%02X ",i);
-             if(byte1>=0) printf("%-10s 0x%02X ",reg0[i],byte1);
+             if(reg0[i][0]!='\00') printf("%-10s 0x%02X ",reg0[i],mem[i]);
              else printf("                ");
 
              printf("   0x%02X ",i+0x80);
-             if(byte2>=0) printf("%-10s 0x%02X\n",reg1[i],byte2);
+             if(reg1[i][0]!='\00') printf("%-10s 0x%02X\n",reg1[i],mem[i+0x80]);
              else printf("            \n");
            }
        }
     }
     else if((peeprom==0)&&(weeprom==0))
     {
-      printf("      0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F\n");
-      for(j=0;j<=1;j++)
+      if(bulk==1)
       {
-        printf("%1d0: ",j);
-        for(i=0;i<=15;i++)
-        {
-           if(reg0[i+j*16][0]!='\00') 
-           {
-             buf[0]=1;
-             buf[1]=i+j*16;
-             if((write(fd, buf, 2)) != 2) 
-             {
-                perror("Error writing to i2c slave");
-                return -1;
-             }
-             if(read(fd, buf,1)!=1) 
-             {
-                perror("Unable to read from slave");
-                return -1;
-             }
-             else 
-             {
-                printf(" %02X",buf[0]);
-             }
-           } 
-           else
-           {
-              printf(" --");
-           }
-        }
-        printf("\n");
+        if(readmem(fd, bulk, 0x00, mem, 0xE0)<0) return -1;
       }
-
-      for(j=2;j<=5;j++)
+      else
       {
-        printf("%1X0: ",j);
-        for(i=0;i<=15;i++)
-        {
-           buf[0]=1;
-           buf[1]=i+j*16;
-           if((write(fd, buf, 2)) != 2) 
-           {
-             perror("Error writing to i2c slave");
-             return -1;
-           }
-           if(read(fd, buf,1)!=1) 
-           {
-             perror("Unable to read from slave");
-             return -1;
-           }
-           else 
-           {
-             printf(" %02X",buf[0]);
-           }
-        }
-        printf("\n");
+        if(readmem(fd, bulk, 0x00, mem, 0x60)<0) return -1;
+        if(readmem(fd, bulk, 0x80, &mem[0x80], 0x60)<0) return -1;
       }
 
-      for(j=0;j<=1;j++)
+      printf("      0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F\n");
+      for(j=0;j<=5;j++)
       {
-        printf("%1X0: ",j+8);
+        printf("%1X0: ",j);
         for(i=0;i<=15;i++)
         {
-           if(reg1[i+j*16][0]!='\00') 
-           {
-             buf[0]=1;
-             buf[1]=i+j*16+0x80;
-             if((write(fd, buf, 2)) != 2) 
-             {
-                perror("Error writing to i2c slave");
-                return -1;
-             }
-             if(read(fd, buf,1)!=1) 
-             {
-                perror("Unable to read from slave");
-                return -1;
-             }
-             else 
-             {
-                printf(" %02X",buf[0]);
-             }
-           } 
-           else
-           {
-              printf(" --");
-           }
+           if((j>=2)||(reg0[i+j*16][0]!='\00')) printf(" %02X",mem[i+j*16]);
+           else printf(" --");
         }
         printf("\n");
       }
 
-      for(j=2;j<=5;j++)
+      for(j=0;j<=5;j++)
       {
         printf("%1X0: ",j+8);
         for(i=0;i<=15;i++)
         {
-           buf[0]=1;
-           buf[1]=i+j*16+0x80;
-           if((write(fd, buf, 2)) != 2) 
-           {
-             perror("Error writing to i2c slave");
-             return -1;
-           }
-           if(read(fd, buf,1)!=1) 
-           {
-             perror("Unable to read from slave");
-             return -1;
-           }
-           else 
-           {
-             printf(" %02X",buf[0]);
-           }
+           if((j>=2)||(reg1[i+j*16][0]!='\00')) printf(" %02X",mem[i+j*16+0x80]);
+           else printf(" --");
         }
         printf("\n");
       }
@@ -343,30 +289,17 @@ int main(int argc, char **argv)
 
   if(peeprom==1)
   {
+    if(readeeprom(fd, bulk, 0x00, mem, 128)<0) return -1;
+
     printf("      0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F\n"); 
     for(j=0;j<=7;j++)
     {
       printf("%1X0: ",j);
       for(i=0;i<=15;i++)
       {
-         buf[0]=3;
-         buf[1]=i+j*16;
-         if((write(fd, buf, 2)) != 2) 
-         {
-           perror("Error writing to i2c slave");
-           return -1;
-         }
-         if(read(fd, buf,1)!=1) 
-         {
-           perror("Unable to read from slave");
-           return -1;
-         }
-         else 
-         {
-           printf(" %02X",buf[0]);
-           if((buf[0]>=32)&&(buf[0]<=126)) lascii[i]=buf[0];
-           else lascii[i]='.';
-         }
+         printf(" %02X",mem[i+j*16]);
+         if((mem[i+j*16]>=32)&&(mem[i+j*16]<=126)) lascii[i]=mem[i+j*16];
+         else lascii[i]='.';
       }
       lascii[16]='\00';
       printf(" %16s\n",lascii);
@@ -48,8 +48,15 @@
 #include "writecmd.h"
 #include "readdata.h"
 #include "testi2c.h"
+#include "transact.h"
+#include "i2csession.h"
+#include "i2cstats.h"
+#include "cmdbatch.h"
+#include "evloop.h"
+#include "picclock.h"
 
 #define CHECK_BIT(var,pos) !!((var) & (1<<(pos)))
+#define CTLSAMPLEMAX 16 // maximum number of A/D conversions for position
 
 const int version=20210102; // program version
 
@@ -61,6 +68,8 @@ char message[ 200 ] = "";
 
 int portno = 5002; // socket port number
 float picycle = 0.445; // length of PIC counter cycles [s]
+int clockint = 600; // PIC counter reading interval for cycle estimate [s], 0=fixed
+struct picclock pclock; // PIC counter cycle estimate
 int forcereset = 0; // force PIC timer reset if i2c test fails
 int maxcycles = -1; // maximum allowed rotation time in PIC cycles
 float rotmax = 1; // maximum number of axis rotations
@@ -68,13 +77,44 @@ float motrpm = 7; // axis turning speed [rpm]
 int mpos = -1; // motor position from AN0 [0-1023]
 int pot = -1; // potentiometer from AN1 [0-1023]
 int track = 0; // 1=track potentiometer position
+float trackmin = 0.2; // shortest potentiometer sampling interval [s]
+float trackmax = 5; // longest potentiometer sampling interval [s]
 int minpos = 0; // motor minimum position [0-1023]
 int maxpos = 1023; // motor maximum position [0-1023]
 char status[ 200 ] = ""; // bridge status message
+float ctlint = 0.05; // position control sampling interval [s]
+int ctlsamples = 2; // A/D conversions averaged for one position sample
+int deadband = 2; // allowed position error at target
+int settlesamples = 3; // samples inside deadband before move is done
+int adcsumok = 0; // 1=A/D conversions summed on PIC with command 0x44
+
+struct motorctl
+{
+  int target; // target position, -1=no move
+  int dir; // driven direction +1=ccw to larger position, -1=cw, 0=stopped
+  int lastdir; // last driven direction
+  int lastpos; // previous position sample
+  int overshoot; // largest position past target
+  int nsettle; // number of samples inside deadband
+  double start; // time move was started [s]
+  double settled; // time position entered deadband [s]
+  double timeout; // time to give up [s]
+  int fd; // client waiting for the result or -1
+};
+struct motorctl mc = { -1, 0, 0, -1, 0, 0, 0, 0, 0, -1 };
+
+struct evloop ev; // event loop serving the clients
+int sockfd = -1; // listening socket
+int statfd = -1; // i2c statistics socket
+int movetask = -1; // position control task
+int tracktask = -1; // potentiometer tracking task
 
 const char confile[ 200 ] = "/etc/pipichbd_config";
 
 const char pidfile[ 200 ] = "/run/pipichbd.pid";
+const char cyclefile[ 200 ] = "/var/lib/pipichbd/picycle"; // PIC cycle estimate
+const char statsfile[ 200 ] = "/run/pipichbd.i2cstats"; // written on SIGUSR1
+const char statsock[ 200 ] = "/run/pipichbd-i2c.sock"; // i2c statistics socket
 
 // read configuration file if it exists
 void read_config()
@@ -108,6 +148,12 @@ void read_config()
              sprintf( message, "Bridge port number set to %d", (int)value );
              syslog( LOG_INFO | LOG_DAEMON, "%s", message );
           }
+          if( strncmp( par, "CLOCKINT", 8 ) == 0 )
+          {
+             clockint = (int)value;
+             sprintf( message, "PIC cycle estimate counter reading interval %d s", (int)value );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+          }
           if( strncmp( par, "PICYCLE", 7 ) == 0 )
           {
              picycle = value;
@@ -126,11 +172,24 @@ void read_config()
              sprintf( message, "motor speed %f rpm", value );
              syslog( LOG_INFO | LOG_DAEMON, "%s", message );
           }
-          if( strncmp( par, "TRACK", 5 ) == 0 )
+// TRACK is compared whole, it is a prefix of TRACKMIN and TRACKMAX
+          if( strcmp( par, "TRACK" ) == 0 )
           {
              track = (int)value;
              if( track == 1 ) syslog( LOG_INFO | LOG_DAEMON, "track potentiometer" );
           }
+          if( strncmp( par, "TRACKMIN", 8 ) == 0 )
+          {
+             trackmin = value;
+             sprintf( message, "shortest tracking interval %f s", value );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+          }
+          if( strncmp( par, "TRACKMAX", 8 ) == 0 )
+          {
+             trackmax = value;
+             sprintf( message, "longest tracking interval %f s", value );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+          }
           if( strncmp( par, "MINPOS", 6 ) == 0 )
           {
              minpos = (int)value;
@@ -143,6 +202,36 @@ void read_config()
              sprintf( message, "set maximum position to %d", maxpos );
              syslog( LOG_INFO | LOG_DAEMON, "%s", message );
           }
+          if( strncmp( par, "CTLINT", 6 ) == 0 )
+          {
+             ctlint = value;
+             sprintf( message, "position control interval %f s", value );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+          }
+          if( strncmp( par, "CTLSAMPLES", 10 ) == 0 )
+          {
+             ctlsamples = (int)value;
+             if( ctlsamples < 1 ) ctlsamples = 1;
+             if( ctlsamples > CTLSAMPLEMAX ) ctlsamples = CTLSAMPLEMAX;
+             sprintf( message, "average %d A/D conversions for position", ctlsamples );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+          }
+          if( strncmp( par, "DEADBAND", 8 ) == 0 )
+          {
+             deadband = (int)value;
+             sprintf( message, "position deadband %d", deadband );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+          }
+          if( strncmp( par, "I2CRDWR", 7 ) == 0 )
+          {
+             i2cses.rdwr = (int)value;
+             if( i2cses.rdwr == 1 ) syslog( LOG_INFO | LOG_DAEMON, "Combined i2c command and reply with repeated start" );
+          }
+          if( strncmp( par, "I2CBUSD", 7 ) == 0 )
+          {
+             i2cses.busd = (int)value;
+             if( i2cses.busd == 1 ) syslog( LOG_INFO | LOG_DAEMON, "i2c transfers through pipicbusd" );
+          }
           if( strncmp( par, "FORCERESET", 10 ) == 0 )
           {
              if( value == 1 )
@@ -173,10 +262,10 @@ int read_status()
   int ok = -1;
   int gpio = 0;
 
-  ok = write_cmd( 0x01, 0x05, 1 ); 
-  if( ok == 1 )
+  gpio = transact( 0x01, 0x05, 1, 1 ); 
+  if( gpio >= 0 )
   { 
-    gpio = read_data( 1 );
+    ok = 1;
     if( CHECK_BIT( gpio, 4 ) == 0 && CHECK_BIT( gpio, 5 ) == 0 )
     {
       strcpy( message, "motor stopped" );
@@ -205,16 +294,46 @@ int read_status()
   return ok;
 }
 
+// average of a burst of A/D conversions, cmd 0x40 for motor position on
+// AN0 or 0x41 for potentiometer on AN1, the first conversion is dropped
+// like in read_motorpos(), with firmware command 0x44 the conversions are
+// summed on PIC
+int read_average(int cmd)
+{
+  int values[ CTLSAMPLEMAX + 1 ];
+  int i, n, sum = 0;
+  struct adcsum adc;
+
+  if( adcsumok == 1 )
+  {
+    if( read_adc( cmd - 0x40, ctlsamples, &adc ) != 1 ) return -1;
+    return ( adc.sum + ctlsamples / 2 ) / ctlsamples;
+  }
+
+  n = transact_repeat( cmd, 0, 0, 2, values, ctlsamples + 1 );
+  if( n != ctlsamples + 1 ) return -1;
+
+  for( i = 1; i < n; i++ )
+  {
+    if( values[ i ] < 0 || values[ i ] > 1023 ) return -1;
+    sum += values[ i ];
+  }
+
+  return ( sum + ctlsamples / 2 ) / ctlsamples;
+}
+
 // read motor position sensor from AN0
 int read_motorpos()
 {
-  int ok = -1;
   int pos = -1;
-  ok = write_cmd( 0x40, 0, 0 ); // A/D conversion is done twice 
-  ok = write_cmd( 0x40, 0, 0 ); 
-  if( ok == 1 )
+  if( adcsumok == 1 ) pos = read_average( 0x40 );
+  else
+  {
+    pos = transact( 0x40, 0, 0, 2 ); // A/D conversion is done twice 
+    pos = transact( 0x40, 0, 0, 2 ); 
+  }
+  if( pos >= 0 )
   { 
-    pos = read_data( 2 );
     sprintf( message, "Motor position at %d", pos );
     syslog( LOG_INFO | LOG_DAEMON, "%s", message );
     if( pos < 0 || pos > 1023 ) pos = -1;
@@ -227,17 +346,23 @@ int read_motorpos()
 // read potentiometer from AN1
 int read_potentiometer()
 {
-  int ok = -1;
   int pot = -1;
-  ok = write_cmd( 0x41, 0, 0 ); // A/D conversion is done twice 
-  ok = write_cmd( 0x41, 0, 0 ); 
-  if( ok == 1 )
+  if( adcsumok == 1 ) pot = read_average( 0x41 );
+  else
+  {
+    pot = transact( 0x41, 0, 0, 2 ); // A/D conversion is done twice 
+    pot = transact( 0x41, 0, 0, 2 ); 
+  }
+  if( pot >= 0 )
   { 
-    pot = read_data( 2 );
     sprintf( message, "Potentiometer at %d", pot );
     syslog( LOG_INFO | LOG_DAEMON, "%s", message );
   }
-  else syslog( LOG_ERR | LOG_DAEMON, "Failed to read PIC AN1" ); 
+  else
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Failed to read PIC AN1" ); 
+    pot = -1;
+  }
 
   return pot;
 }
@@ -254,36 +379,41 @@ int stop_motor()
 }
 
 // turn motor, rotcw=+1 clockwise, -1 counter clockwise, stop after given
-// number of cycles
+// number of cycles, both timed tasks are programmed in one batch
 int turn_motor(int rotcw, int cycles)
 {
   int ok = 0;
+  struct cmdbatch batch;
 
   if( cycles > 2 && cycles < maxcycles )
   { 
+     cmdbatch_init( &batch );
+
 // timed task1 to start turning motor
-     ok = write_cmd( 0x62, 2, 4 ); // start after 2 cycles
+     cmdbatch_add( &batch, 0x62, 2, 4 ); // start after 2 cycles
      if( rotcw == +1 ) 
      {
-       ok = write_cmd( 0x63, 0x301F, 2 );
+       cmdbatch_add( &batch, 0x63, 0x301F, 2 );
        syslog( LOG_INFO | LOG_DAEMON, "turn motor cw" );
      } 
      else if( rotcw == -1 ) 
      {
-       ok = write_cmd( 0x63, 0x302F, 2 );
+       cmdbatch_add( &batch, 0x63, 0x302F, 2 );
        syslog( LOG_INFO | LOG_DAEMON, "turn motor ccw" );
      } 
-     ok = write_cmd( 0x64, 0, 1 ); // do task once
+     cmdbatch_add( &batch, 0x64, 0, 1 ); // do task once
 
 // timed task2 to stop motor
-     ok = write_cmd( 0x72, cycles, 4 ); // stop after given cycles
-     ok = write_cmd( 0x73, 0x300F, 2 );
+     cmdbatch_add( &batch, 0x72, cycles, 4 ); // stop after given cycles
+     cmdbatch_add( &batch, 0x73, 0x300F, 2 );
      sprintf( message, "stop motor after %d PIC cycles", cycles );
      syslog( LOG_INFO | LOG_DAEMON, "%s", message );
-     ok = write_cmd( 0x74, 0 ,1 ); // do task once
+     cmdbatch_add( &batch, 0x74, 0 ,1 ); // do task once
 
-     ok = write_cmd( 0x61, 0 , 0 ); // start task1
-     ok = write_cmd( 0x71, 0 , 0 ); // start task2
+     cmdbatch_add( &batch, 0x61, 0 , 0 ); // start task1
+     cmdbatch_add( &batch, 0x71, 0 , 0 ); // start task2
+
+     ok = cmdbatch_flush( &batch );
   }
 
   return ok;
@@ -318,24 +448,187 @@ int goto_pos(int topos)
   return ( dt * ok );
 }
 
-// set motor position, first 90 % of travel, then rest and finally correction
-// steps if needed
-int set_pos(int topos)
+// drive H-bridge directly, dir=+1 ccw, -1 cw and 0 stop
+int drive_motor(int dir)
 {
   int ok = 0;
 
-  int nxtpos = (int)( 0.9 * ( topos - mpos ) + mpos );
-  int dt = goto_pos( nxtpos );
-
-  sleep( dt + 1 );
-  mpos = read_motorpos();
-  dt = goto_pos( topos );
-  sleep( dt + 1 );
-  mpos = read_motorpos();
+  if( dir > 0 ) ok = write_cmd( 0x30, 0x2F, 1 );
+  else if( dir < 0 ) ok = write_cmd( 0x30, 0x1F, 1 );
+  else ok = write_cmd( 0x30, 0x0F, 1 );
+  if( ok != 1 ) syslog( LOG_ERR | LOG_DAEMON, "driving motor failed" );
 
   return ok;
 }
 
+// send status to client and close the connection
+void send_reply(int fd)
+{
+  char sbuff[ 25 ];
+
+  snprintf( sbuff, sizeof( sbuff ), "%.24s", status );
+
+  if( send( fd, sbuff, strlen( sbuff ), MSG_DONTWAIT | MSG_NOSIGNAL ) < 0 )
+    syslog( LOG_ERR | LOG_DAEMON, "Socket writing failed" );
+  else syslog( LOG_DEBUG, "Send: %s", sbuff );
+
+  close( fd );
+}
+
+// end position control, the PIC safety stop is cancelled and the waiting
+// client gets the result
+void move_done(const char *result)
+{
+  if( mc.dir != 0 ) drive_motor( 0 );
+  write_cmd( 0x70, 0x00, 1 ); // cancel safety stop in task2
+
+  mc.dir = 0;
+  mc.target = -1;
+  evloop_schedule( &ev, movetask, -1 );
+
+  syslog( LOG_INFO | LOG_DAEMON, "%s", result );
+  if( mc.fd >= 0 )
+  {
+    send_reply( mc.fd );
+    mc.fd = -1;
+  }
+}
+
+// start closed loop move to given position, client fd waits for the
+// result, a move already running is replaced
+// return: 1=started, 0=out of range or position not readable
+int start_move(int topos, int fd)
+{
+  int pos = 0;
+  int cycles = 0;
+  double movetime = 0;
+  struct cmdbatch batch;
+
+  if( topos < minpos || topos > maxpos )
+  {
+    sprintf( message, "motor position out of range [%d-%d]", minpos, maxpos );
+    syslog( LOG_NOTICE | LOG_DAEMON, "%s", message );
+    sprintf( status, "out of range" );
+    return 0;
+  }
+
+  pos = read_average( 0x40 );
+  if( pos < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Failed to read PIC AN0" ); 
+    sprintf( status, "position unknown" );
+    return 0;
+  }
+
+  if( mc.target >= 0 && mc.fd >= 0 )
+  {
+    sprintf( status, "move replaced" );
+    send_reply( mc.fd );
+  }
+
+// PIC stops the motor with task2 in case the daemon does not, allow twice
+// the turning time estimated from the motor speed
+  movetime = rotmax * 60.0 * abs( topos - pos ) / ( 1024.0 * motrpm );
+  cycles = (int)( ( 2 * movetime + 2 ) / picycle ) + 2;
+  cmdbatch_init( &batch );
+  cmdbatch_add( &batch, 0x72, cycles, 4 );
+  cmdbatch_add( &batch, 0x73, 0x300F, 2 );
+  cmdbatch_add( &batch, 0x74, 0, 1 );
+  cmdbatch_add( &batch, 0x71, 0, 0 );
+  if( cmdbatch_flush( &batch ) != 1 ) syslog( LOG_ERR | LOG_DAEMON, "failed to set safety stop" );
+
+// a replaced move keeps the direction the H-bridge is driven to so that
+// task_move() stops or reverses the motor for the new target
+  if( mc.target < 0 ) mc.dir = 0;
+  if( mc.dir == 0 ) mc.lastdir = ( topos > pos ) ? 1 : -1;
+  mc.target = topos;
+  mc.lastpos = pos;
+  mc.overshoot = 0;
+  mc.nsettle = 0;
+  mc.start = evloop_now();
+  mc.settled = mc.start;
+  mc.timeout = mc.start + 2 * movetime + 2;
+  mc.fd = fd;
+
+  sprintf( message, "move from %d to %d", pos, topos );
+  syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+
+  evloop_schedule( &ev, movetask, 0 );
+
+  return 1;
+}
+
+// bang-bang position control with deadband, the motor is stopped ahead of
+// target by the distance it moved during the last sample interval and
+// driven back if it coasts out of the deadband, the move is done after
+// the position has stayed in the deadband for 'settlesamples' samples
+double task_move()
+{
+  int pos, err, lead, past;
+  double now = evloop_now();
+
+  if( mc.target < 0 ) return -1;
+
+  pos = read_average( 0x40 );
+  if( pos < 0 )
+  {
+    sprintf( status, "position unknown" );
+    move_done( "position control stopped, failed to read PIC AN0" );
+    return -1;
+  }
+  mpos = pos;
+
+  err = mc.target - pos;
+  lead = abs( pos - mc.lastpos );
+  mc.lastpos = pos;
+
+  if( mc.dir != 0 && err * mc.dir <= deadband + lead )
+  {
+    if( drive_motor( 0 ) == 1 ) mc.dir = 0;
+  }
+
+  past = ( pos - mc.target ) * mc.lastdir;
+  if( past > mc.overshoot ) mc.overshoot = past;
+
+  if( mc.dir == 0 )
+  {
+    if( abs( err ) <= deadband )
+    {
+      if( mc.nsettle == 0 ) mc.settled = now;
+      mc.nsettle++;
+      if( mc.nsettle >= settlesamples )
+      {
+        sprintf( status, "at %d %.1fs over %d", pos, mc.settled - mc.start, mc.overshoot );
+        sprintf( message, "motor at %d, settled in %.2f s with overshoot %d", pos, mc.settled - mc.start, mc.overshoot );
+        move_done( message );
+        return -1;
+      }
+    }
+    else
+    {
+      mc.nsettle = 0;
+      mc.dir = ( err > 0 ) ? 1 : -1;
+      mc.lastdir = mc.dir;
+      if( drive_motor( mc.dir ) != 1 )
+      {
+        mc.dir = 0;
+        sprintf( status, "drive failed at %d", pos );
+        move_done( "position control stopped, failed to drive motor" );
+        return -1;
+      }
+    }
+  }
+
+  if( now > mc.timeout )
+  {
+    sprintf( status, "timeout at %d", pos );
+    sprintf( message, "position control timeout at %d, target %d", pos, mc.target );
+    move_done( message );
+    return -1;
+  }
+
+  return ctlint;
+}
 
 // reset PIC internal timer
 int resetimer()
@@ -343,10 +636,221 @@ int resetimer()
   int ok = -1;
 
   ok = write_cmd( 0x50, 0, 0 );
+  picclock_reset( &pclock );
 
   return ok;
 }
 
+// read PIC counter to follow the cycle length, the maximum turning time
+// in cycles follows the estimate
+double task_clock()
+{
+  int timer;
+  double t;
+
+  t = evloop_now();
+  timer = transact( 0x51, 0, 0, 4 );
+  if( picclock_sample( &pclock, timer, 0.5 * ( t + evloop_now() ) ) == 1 )
+  {
+    picycle = pclock.cycle;
+    maxcycles = (int)( rotmax * 60 / ( motrpm * picycle ) );
+  }
+
+  return clockint;
+}
+
+// track potentiometer on AN1 with closed loop moves, the potentiometer is
+// sampled so that it is expected to change about 'deadband' between
+// samples, the interval is doubled while it does not change
+double task_track()
+{
+  static int lastpot = -1;
+  static double lastime = 0;
+  static double delay = 0;
+  int p, change;
+  double now = evloop_now();
+
+  if( track != 1 )
+  {
+    lastpot = -1;
+    delay = 0;
+    return -1;
+  }
+
+  p = read_average( 0x41 );
+  if( p < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Failed to read PIC AN1" ); 
+    return trackmax;
+  }
+  pot = p;
+  if( p < minpos ) p = minpos;
+  else if( p > maxpos ) p = maxpos;
+
+  if( lastpot < 0 ) change = 0;
+  else change = abs( p - lastpot );
+
+  if( mc.target >= 0 )
+  {
+    if( abs( p - mc.target ) > deadband ) start_move( p, -1 ); // follow
+  }
+  else if( lastpot < 0 || change > deadband )
+  {
+    mpos = read_average( 0x40 );
+    if( mpos >= 0 && abs( mpos - p ) > deadband )
+    {
+      sprintf( message, "motor at %d and potentiometer at %d", mpos, p );
+      syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+      start_move( p, -1 );
+    }
+  }
+
+  if( lastpot < 0 || change == 0 ) delay *= 2;
+  else delay = deadband * ( now - lastime ) / change;
+  if( delay < trackmin ) delay = trackmin;
+  if( delay > trackmax ) delay = trackmax;
+
+  lastpot = p;
+  lastime = now;
+
+  return delay;
+}
+
+// run one client command
+// return: 1=reply now, 0=reply when the move is done
+int run_cmd(int fd, const char *rbuff)
+{
+  int cycles = 0;
+  int topos = -1;
+
+  if( strncmp( rbuff, "stop", 4 ) == 0 )
+  {
+    stop_motor();
+    if( mc.target >= 0 )
+    {
+      sprintf( status, "stopped at %d", mc.lastpos );
+      mc.dir = 0;
+      move_done( "position control stopped" );
+    }
+    sprintf( status, "motor stopped" );
+  } 
+  else if( strncmp( rbuff, "pos", 3 ) == 0 )
+  {
+    mpos = read_motorpos();
+    sprintf( status, "motor at %d", mpos );
+  } 
+  else if( strncmp( rbuff, "pot", 3 ) == 0 )
+  {
+    pot = read_potentiometer();
+    sprintf( status, "pot at %d", pot );
+  } 
+  else if( strncmp( rbuff, "cw", 2 ) == 0 )
+  {
+    if( sscanf( rbuff, "cw %d", &cycles ) != EOF )
+    {
+      turn_motor( 1, cycles );
+      sprintf( status, "turn cw" );
+    }
+  } 
+  else if( strncmp( rbuff, "ccw", 3 ) == 0 )
+  {
+    if( sscanf( rbuff, "ccw %d", &cycles ) != EOF )
+    {
+      turn_motor( -1, cycles );
+      sprintf( status, "turn ccw" );
+    }
+  }
+  else if( strncmp( rbuff, "go", 2 ) == 0 )
+  {
+    if( sscanf( rbuff, "go %d", &topos ) != EOF )
+    {
+      mpos = read_motorpos(); // initial position
+      goto_pos( topos );
+      mpos = read_motorpos();
+      sprintf( status, "motor at %d", mpos );
+    }
+  }
+  else if( strncmp( rbuff, "set", 3 ) == 0 )
+  {
+    if( sscanf( rbuff, "set %d", &topos ) != EOF )
+    {
+      if( start_move( topos, fd ) == 1 ) return 0;
+    }
+  }
+  else if( strncmp( rbuff, "track", 5 ) == 0 )
+  {
+    if( strncmp( rbuff, "track on", 8 ) == 0 ) track = 1;
+    else if( strncmp( rbuff, "track off", 9 ) == 0 ) track = 0;
+    else track = !track;
+
+    if( track == 1 )
+    {
+      syslog( LOG_NOTICE | LOG_DAEMON, "start tracking motor position" );
+      sprintf( status, "tracking on" );
+      evloop_schedule( &ev, tracktask, 0 );
+    }
+    else
+    {
+      syslog( LOG_NOTICE | LOG_DAEMON, "stop tracking potentiometer" );
+      sprintf( status, "tracking off" );
+    }
+  }
+  else if( strncmp( rbuff, "status", 6 ) == 0 )
+  {
+    read_status();
+  } 
+
+  return 1;
+}
+
+// read one command from client and reply, the connection is closed after
+// the reply
+void client_ready(int fd)
+{
+  int n;
+  char rbuff[ 25 ];
+
+  evloop_unwatch( &ev, fd );
+
+  n = read( fd, rbuff, 24 );
+  if( n <= 0 )
+  {
+    if( n < 0 ) syslog( LOG_ERR | LOG_DAEMON, "Socket reading failed" );
+    close( fd );
+    return;
+  }
+  rbuff[ n ] = 0;
+
+  sprintf( message, "Received: %s", rbuff );
+  syslog( LOG_DEBUG, "%s", message );
+
+  if( run_cmd( fd, rbuff ) == 1 )
+  {
+    send_reply( fd );
+    strcpy( status, "" );
+  }
+}
+
+// accept new client
+void client_accept(int fd)
+{
+  int connfd;
+
+  connfd = accept( fd, NULL, NULL );
+  if( connfd < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Socket accept failed" );
+    return;
+  }
+
+  if( evloop_watch( &ev, connfd, &client_ready ) != 1 )
+  {
+    close( connfd );
+    return;
+  }
+  syslog( LOG_NOTICE | LOG_DAEMON, "Socket accepted" );
+}
+
 int cont = 1; /* main loop flag */
 
 void stop(int sig)
@@ -356,18 +860,25 @@ void stop(int sig)
   cont = 0;
 }
 
+volatile sig_atomic_t termsig = 0; // 1=SIGTERM received
+
+// the motor is stopped from the main loop after SIGTERM so that the
+// handler does not use the i2c session in the middle of a transfer
 void terminate(int sig)
 {
-  sprintf( message, "signal %d catched", sig );
-  syslog( LOG_NOTICE | LOG_DAEMON, "%s", message );
-  sleep( 1 );
-  syslog( LOG_NOTICE | LOG_DAEMON, "stop" );
+  termsig = 1;
+  cont = 0;
+}
 
-  sleep( 1 );
+// stop the motor and cancel the safety stop in task2
+void stop_exit()
+{
+  syslog( LOG_NOTICE | LOG_DAEMON, "signal %d catched", SIGTERM );
 
-  cont = 0;
+  stop_motor();
+  write_cmd( 0x70, 0x00, 1 );
 
-  exit( EXIT_SUCCESS );
+  syslog( LOG_NOTICE | LOG_DAEMON, "stop" );
 }
 
 void hup(int sig)
@@ -378,6 +889,14 @@ void hup(int sig)
   track = 0;
 }
 
+volatile sig_atomic_t dumpstats = 0; // 1=write i2c statistics to file
+
+// the statistics file is written from the main loop after SIGUSR1
+void usr1(int sig)
+{
+  dumpstats = 1;
+}
+
 int main()
 {  
   int ok = 0;
@@ -390,8 +909,11 @@ int main()
   signal( SIGTERM, &terminate ); 
   signal( SIGQUIT, &stop ); 
   signal( SIGHUP, &hup ); 
+  signal( SIGUSR1, &usr1 ); 
 
   read_config(); // read configuration file
+  picclock_init( &pclock, picycle, ( clockint > 0 ) ? cyclefile : NULL );
+  picycle = pclock.cycle;
   maxcycles = (int)( rotmax * 60 / ( motrpm * picycle ) );
   sprintf( message, "set maximum turning time to %d cycles", maxcycles ); 
   syslog( LOG_NOTICE | LOG_DAEMON, "%s", message );
@@ -488,12 +1010,9 @@ int main()
   fclose( pidf );
 
 // open socket
-  int sockfd, connfd, clilen;
-  char rbuff[ 25 ];
-  char sbuff[ 25 ];
-  struct sockaddr_in serv_addr, cli_addr; 
+  struct sockaddr_in serv_addr; 
 
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  sockfd = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
   if( sockfd < 0 ) 
   {
     syslog( LOG_ERR | LOG_DAEMON, "Could not open socket" );
@@ -502,7 +1021,6 @@ int main()
   else syslog( LOG_NOTICE | LOG_DAEMON, "Socket open" );
   
   memset( &serv_addr, '0', sizeof( serv_addr ) );
-  memset( sbuff, '0', sizeof( sbuff ) ); 
 
   serv_addr.sin_family = AF_INET;
   serv_addr.sin_addr.s_addr = htonl( INADDR_ANY );
@@ -518,17 +1036,11 @@ int main()
     syslog( LOG_NOTICE | LOG_DAEMON, "Socket binding successful" );
   }
 
-  listen( sockfd, 1 ); // listen one client only 
-  clilen = sizeof( cli_addr );
+  listen( sockfd, 4 );
  
-  sleep( 1 );
+  adcsumok = testadcsum();
+  if( adcsumok == 1 ) syslog( LOG_INFO | LOG_DAEMON, "A/D conversions summed on PIC" );
 
-  int cycles = 0;
-  int dt = 0;
-  int idelt = 0;
-  int mpos2 = 0;
-  int pot2 = 0;
-  int topos = -1;
   mpos = read_motorpos();
   pot = read_potentiometer();
   if( loglev > 2 )
@@ -537,143 +1049,37 @@ int main()
     syslog( LOG_INFO | LOG_DAEMON, "%s", message );
   }
 
-  int n = 0;
-  while( cont == 1 )
+  if( evloop_init( &ev ) != 1 || evloop_watch( &ev, sockfd, &client_accept ) != 1 )
   {
-// track motor position with the potentiometer connected on AN1
-    idelt = 10;
-    while( track == 1 )
-    {
-      mpos = read_motorpos();
-      sleep( 1 );
-      mpos = read_motorpos();
-      sleep( 1 );
-      pot = read_potentiometer();
-      sleep( 1 );
-      pot = read_potentiometer();
-
-      if( pot < minpos ) pot = minpos;
-      else if( pot > maxpos ) pot = maxpos;
-      if( mpos != mpos2 || pot != pot2 )
-      {
-        sprintf( message, "motor at %d and potentiometer at %d", mpos, pot );
-        syslog( LOG_INFO | LOG_DAEMON, "%s", message );
-      }
-      mpos2 = mpos;
-      pot2 = pot;
-      if( abs( mpos - pot ) > 1 )
-      {
-        dt = goto_pos( pot );
-        if( dt >= 0 ) sleep( dt + 1 );
-        idelt = 10;
-      }
-      else if( idelt < 50 ) idelt++; // read mpos and pot less freq if no change
-      sleep( idelt / 10 ); 
-    }
-
-    connfd = accept(sockfd, (struct sockaddr*)&cli_addr, (socklen_t *)&clilen); 
-    if( connfd < 0 ) 
-    {
-      syslog( LOG_ERR | LOG_DAEMON, "Socket accept failed" );
-      exit( EXIT_FAILURE );
-    }
-    else syslog( LOG_NOTICE | LOG_DAEMON, "Socket accepted" );
-
-    bzero( rbuff, 25 );
-    n = read( connfd, rbuff, 24 );
-    if( n < 0 )
-    {
-      syslog( LOG_ERR | LOG_DAEMON, "Socket reading failed" );
-      exit( EXIT_FAILURE );
-    }
-    else
-    {
-      sprintf( message, "Received: %s", rbuff );
-      syslog( LOG_DEBUG, "%s", message );
-    }
-
-    if( strncmp( rbuff, "stop", 4 ) == 0 )
-    {
-      ok = stop_motor();
-      sprintf( status, "motor stopped" );
-    } 
-    else if( strncmp( rbuff, "pos", 3 ) == 0 )
-    {
-      mpos = read_motorpos();
-      sprintf( status, "motor at %d", mpos );
-    } 
-    else if( strncmp( rbuff, "pot", 3 ) == 0 )
-    {
-      pot = read_potentiometer();
-      sprintf( status, "pot at %d", pot );
-    } 
-    else if( strncmp( rbuff, "cw", 2 ) == 0 )
-    {
-      if( sscanf( rbuff, "cw %d", &cycles ) != EOF )
-      {
-        ok = turn_motor( 1, cycles );
-        sprintf( status, "turn cw" );
-      }
-    } 
-    else if( strncmp( rbuff, "ccw", 3 ) == 0 )
-    {
-      if( sscanf( rbuff, "ccw %d", &cycles ) != EOF )
-      {
-        ok = turn_motor( -1, cycles );
-        sprintf( status, "turn ccw" );
-      }
-    }
-    else if( strncmp( rbuff, "go", 2 ) == 0 )
-    {
-      if( sscanf( rbuff, "go %d", &topos ) != EOF )
-      {
-        mpos = read_motorpos(); // initial position
-        ok = goto_pos( topos );
-        mpos = read_motorpos();
-        sprintf( status, "motor at %d", mpos );
-      }
-    }
-    else if( strncmp( rbuff, "set", 3 ) == 0 )
-    {
-      if( sscanf( rbuff, "set %d", &topos ) != EOF )
-      {
-        mpos = read_motorpos(); // initial position
-        ok = set_pos( topos );
-        mpos = read_motorpos();
-        sprintf( status, "motor at %d", mpos );
-      }
-    }
-    else if( strncmp( rbuff, "track", 5 ) == 0 )
-    {
-      syslog( LOG_NOTICE | LOG_DAEMON, "start tracking motor position" );
-      sprintf( status, "start tracking motor position" );
-      track = 1;
-    }
-    else if( strncmp( rbuff, "status", 6 ) == 0 )
-    {
-      ok = read_status();
-    } 
+    syslog( LOG_ERR | LOG_DAEMON, "Could not start event loop" );
+    exit( EXIT_FAILURE );
+  }
+  movetask = evloop_task( &ev, &task_move, -1 );
+  tracktask = evloop_task( &ev, &task_track, ( track == 1 ) ? 0 : -1 );
+  if( clockint > 0 ) evloop_task( &ev, &task_clock, 0 );
 
-    sleep( 1 );
-    snprintf( sbuff, sizeof( sbuff ), "%.24s", status );
+  statfd = i2c_stats_listen( statsock );
+  if( statfd >= 0 ) evloop_watch( &ev, statfd, &i2c_stats_serve );
 
-    n = write( connfd, sbuff, strlen( sbuff ) ); 
-    if( n < 0 )
-    {
-      sprintf( message, "Socket writing failed" );
-      exit( EXIT_FAILURE );
-    }
-    else
+  while( cont == 1 )
+  {
+    if( evloop_run( &ev ) < 0 ) cont = 0;
+    if( dumpstats == 1 )
     {
-      sprintf( message, "Send: %s", sbuff );
-      syslog( LOG_DEBUG, "%s", message );
+      dumpstats = 0;
+      i2c_stats_dump( statsfile );
     }
+  }
 
-    close( connfd );
-    strcpy( status, "" );
-    sleep( 1 );
+  evloop_close( &ev );
+  if( statfd >= 0 )
+  {
+    close( statfd );
+    unlink( statsock );
   }
 
+  if( termsig == 1 ) stop_exit();
+
   syslog( LOG_NOTICE | LOG_DAEMON, "remove PID file" );
   ok=remove( pidfile );
 
@@ -36,23 +36,49 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/inotify.h>
 #include <unistd.h>
 #include <time.h>
 #include <signal.h>
 #include <syslog.h>
+#include <linux/gpio.h>
 #include "pipicpowerd.h"
 #include "writecmd.h"
 #include "readdata.h"
 #include "testi2c.h"
+#include "transact.h"
+#include "i2csession.h"
+#include "i2cstats.h"
+#include "cmdbatch.h"
+#include "evloop.h"
+#include "picclock.h"
+#include "statlog.h"
+#include "sysact.h"
+#include "clockchk.h"
+#include "battstate.h"
 
 const int version = 20201229; // program version
 
+#define VOLTSAMPLEMAX 32 // maximum number of AN3 conversions for one reading
+#define SLEEPDELAYMAX 600 // longest wait before the sleep time is computed again [s]
+#define CTLPOLL 60 // control file reading interval without inotify [s]
+#define BUTTONSAFE 600 // button reading interval with GPIO line [s]
+
 int voltint = 300; // battery voltage reading interval [s]
-int buttonint = 10; // button reading interval [s]
+int buttonint = 10; // maximum button reading interval [s]
+float buttonmin = 1; // button reading interval after button press [s]
+int buttonidle = 60; // maximum button reading interval when idle [s]
+int buttongpio = -1; // GPIO line wired to push button, -1=polling only
 int confdelay = 10; // delay to wait for confirmation [s]
 int pwrdown = 100; // delay to power down in PIC counter cycles
 float picycle = 0.445; // length of PIC counter cycles [s]
+int clockint = 600; // PIC counter reading interval for cycle estimate [s], 0=fixed
+struct picclock pclock; // PIC counter cycle estimate
 int countint = 0; // PIC counter reading interval [s] 
+int battfiles = 900; // interval to write old battery files [s], 0=not written
+double battfilestime = -1; // last time battery files were written [s]
+struct battstate *battst = NULL; // shared battery state
+struct battvalues battv; // values for the shared battery state
 int wifint = 0; // WiFi checking interval [s]
 int wifitimeout = 3600; // time out before any action is taken [s]
 int wifiact = 0; // WiFi down action: 0=nothing, 1=downup, 2=reboot, 3=pwr cycle
@@ -72,14 +98,21 @@ int battfull = 0; // battery is full 100 %
 int solarpwr = 0; // solar panel is used for charging
 int solardays = 0; // how many days of history is used to calculate power up time
 int solarcycle = 100; // how many minutes are used in cyclic operation
-int sleepint = 60; // how often to check sleep file [s]
-int pdownint = 60; // how often to check cyclic power up file [s]
+int sleepmins = -1; // sleep time from file [min from midnight], -1=none
+int pupmins = 0; // maximum power up time from file [min], 0=none
+int pdownmins = 2; // power down time from file for cyclic operation [min]
+volatile sig_atomic_t pdownok = 0; // 1=power down with SIGHUP allowed
+int ctlfd = -1; // inotify for control file changes, -1=files are polled
 int downmins = 10; // minutes for cyclic power down
 int forcereset = 0; // force PIC timer reset if i2c test fails
 int forceoff = 0; // force power off after give PIC counter cycles
 int forceon = 0; // force power up after give PIC counter cycles
+int voltsettle = 1000; // settling time after GP5 is set before reading AN3 [ms]
+int voltsamples = 4; // number of AN3 conversions averaged for one reading
+int adcsumok = 0; // 1=AN3 conversions summed on PIC with command 0x44
 
 const char *i2cdev = "/dev/i2c-1";
+const char gpiochip[ 200 ] = "/dev/gpiochip0";
 const int  address = 0x26;
 const int  i2lockmax = 10; // maximum number of times to try lock i2c port  
 
@@ -100,15 +133,22 @@ const char timerfile[ 200 ] = "/var/lib/pipicpowerd/timer";
 const char tempfile[ 200 ] = "/tmp/bmp280_x77_T";
 const char puptimefile[ 200 ] = "/var/lib/pipicpowerd/puptime";
 const char pdowntimefile[ 200 ] = "/var/lib/pipicpowerd/pdowntime";
+const char ctldir[ 200 ] = "/var/lib/pipicpowerd"; // watched for control file changes
 const char cputempfile[ 200 ] = "/sys/class/thermal/thermal_zone0/temp";
 const char wifistate[ 200 ] = "/sys/class/net/wlan0/operstate";
 
 const char pidfile[ 200 ] = "/run/pipicpowerd.pid";
+const char cyclefile[ 200 ] = "/var/lib/pipicpowerd/picycle"; // PIC cycle estimate
+const char statsfile[ 200 ] = "/run/pipicpowerd.i2cstats"; // written on SIGUSR1
+const char statsock[ 200 ] = "/run/pipicpowerd-i2c.sock"; // i2c statistics socket
+const char battstatefile[ 200 ] = "/run/pipicpowerd.battery"; // shared battery state
 
 int loglev = 6;
 char message[ 250 ] = "";
 int logstats = 0;
-const char statfile[ 200 ] = "/var/log/pipicpowers.log";
+const char statfile[ 200 ] = "/var/log/pipicpowers.log"; // old text log, converted once
+const char statlogfile[ 200 ] = "/var/log/pipicpowers.dat";
+const char statdayfile[ 200 ] = "/var/log/pipicpowers.days";
 
 // optional scripts to execute at power up or power down
 const char atpwrup[ 200 ] = "/usr/local/bin/atpwrup";
@@ -125,7 +165,6 @@ int settime=1;
 
 // write usage statistics
 void writestat(
-const char statfile[ 200 ], 
 unsigned unxstart, 
 unsigned unxstop, 
 int timerstart, 
@@ -141,46 +180,33 @@ float Tcpuave,
 float Tcpumax, 
 int wifiuptime)
 {
-  time_t now;
-  char tstr[ 25 ];
-  struct tm* tm_info;
-  FILE *sfile;
-
-  time( &now );
-  tm_info = localtime(&now);
-  strftime(tstr, 25, "%Y-%m-%d %H:%M:%S", tm_info);
-
-  int dt = (int)( picycle * ( timerstop - timerstart ) );
-  sfile = fopen(statfile, "a");
-  if( NULL == sfile )
-  {
-      perror("could not open statistics file");
-  }
-  else
-  { 
-      fprintf(sfile, "%s %u %u", tstr, unxstart, unxstop);
-      fprintf(sfile, " %d %d %d", timerstart, timerstop, dt);
-      fprintf(sfile, " %5.2f %5.2f %5.2f", Vmin, Vave, Vmax);
-      fprintf(sfile, " %+5.2f %+5.2f %+5.2f", Tmin, Tave, Tmax);
-      fprintf(sfile, " %+5.2f %+5.2f %+5.2f", Tcpumin, Tcpuave, Tcpumax);
-      fprintf(sfile, " %d\n", wifiuptime);
-      fclose( sfile );
-  }
+  struct statrec r;
+
+  r.logtime = time( NULL );
+  r.start = unxstart;
+  r.stop = unxstop;
+  r.timerstart = timerstart;
+  r.timerstop = timerstop;
+  r.dt = (int)( picycle * ( timerstop - timerstart ) );
+  r.wifiuptime = wifiuptime;
+  r.Vmin = Vmin;
+  r.Vave = Vave;
+  r.Vmax = Vmax;
+  r.Tmin = Tmin;
+  r.Tave = Tave;
+  r.Tmax = Tmax;
+  r.Tcpumin = Tcpumin;
+  r.Tcpuave = Tcpuave;
+  r.Tcpumax = Tcpumax;
+
+  if( statlog_append( statlogfile, statdayfile, &r ) != 1 ) syslog( LOG_ERR | LOG_DAEMON, "could not write statistics");
 }
 
-// read usage statistics file to calulate average power up time for last days
-// and update files /var/lib/pipicpowerd/puptime and 
-// /var/lib/pipicpowerd/pdowntime
-void calcuptime(const char statfile[200], int unxstart, int solardays, int solarcycle)
+// sum power up times of last days from the statistics day file to update
+// files /var/lib/pipicpowerd/puptime and /var/lib/pipicpowerd/pdowntime
+void calcuptime(int unxstart, int solardays, int solarcycle)
 {
-  FILE *sfile, *ufile;
-  char *line = NULL;
-  char dat[ 100 ];
-  char time[ 100 ];
-  int t, start, dt;
-  float v;
-  size_t len;
-  ssize_t read;
+  FILE *ufile;
 
   int t0 = unxstart - 24*3600*solardays;
   int monthago = unxstart - 24*3600*30;
@@ -189,25 +215,12 @@ void calcuptime(const char statfile[200], int unxstart, int solardays, int solar
   int upmins = 0, downmins = 0; 
   int histok = 0;
 
-  line = malloc( sizeof(char) * 200 );
-  sfile = fopen(statfile, "r");
-  if( NULL != sfile )
+  statlog_import( statfile, statlogfile, statdayfile );
+
+  uptime = statlog_uptime( statlogfile, statdayfile, t0, monthago, &histok );
+  if( uptime >= 0 )
   {
-    syslog( LOG_INFO | LOG_DAEMON, "Read usage statistics file" );
-    while( ( read = getline(&line, &len, sfile) ) != -1 )
-    {
-// 2015-03-30 03:09:17 1427677740 1427677757 8535992 8536617 311 10.88 10.88 10.88 +9.00 +9.00 +9.00 +17.49 +17.49 +17.49 0
-       if( sscanf( line, "%s %s %d %d %d %d %d %f %f %f %f %f %f %f %f %f %d", dat, time, &start, &t, &t, &t, &dt, &v, &v, &v, &v, &v, &v, &v, &v, &v, &t) != EOF )
-       {
-          if( start > t0 )
-          {
-             snprintf( message, 224, "%s %s %d %d", dat, time, start, dt);
-             syslog( LOG_DEBUG, "%s", message);
-             uptime += (float)dt;
-          }
-          else if( start > monthago ) histok = 1;
-       }
-    }
+    syslog( LOG_INFO | LOG_DAEMON, "Read usage statistics day file" );
     fuptime = 100 * uptime / ( 24 * 3600 * solardays ); 
     syslog( LOG_INFO | LOG_DAEMON, "Total uptime %8.0f s or %3.0f %% last %d days", uptime, fuptime, solardays);
     if( ( fuptime > 0 ) && ( fuptime <= 100 ) && ( histok == 1 ) )
@@ -244,10 +257,7 @@ void calcuptime(const char statfile[200], int unxstart, int solardays, int solar
     {
        syslog( LOG_ERR | LOG_DAEMON, "not enough history or problem in calculation");
     }
-
-    fclose( sfile );
   }
-  free( line );
 }
 
 // read configuration file if it exists
@@ -280,7 +290,7 @@ void read_config()
           if( strncmp(par, "LOGSTAT", 7 ) == 0 )
           {
              logstats = (int)value;
-             if( value == 1 ) syslog( LOG_INFO | LOG_DAEMON, "Log statistics to 'pipicpowers.log'");
+             if( value == 1 ) syslog( LOG_INFO | LOG_DAEMON, "Log statistics to 'pipicpowers.dat'");
           }
           if( strncmp(par, "VOLTINT", 7) == 0 )
           {
@@ -288,6 +298,20 @@ void read_config()
              sprintf( message, "Voltage reading interval set to %d s", (int)value);
              syslog( LOG_INFO | LOG_DAEMON, "%s", message);
           }
+          if( strncmp(par, "VOLTSETTLE", 10) == 0 )
+          {
+             voltsettle = (int)value;
+             sprintf( message, "Voltage settling time set to %d ms", (int)value);
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+          }
+          if( strncmp(par, "VOLTSAMPLES", 11) == 0 )
+          {
+             voltsamples = (int)value;
+             if( voltsamples < 1 ) voltsamples = 1;
+             if( voltsamples > VOLTSAMPLEMAX ) voltsamples = VOLTSAMPLEMAX;
+             sprintf( message, "Average %d AN3 conversions for voltage reading", voltsamples);
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+          }
           if( strncmp(par, "VOLTCAL", 7 ) == 0 )
           {
              voltcal = value;
@@ -324,6 +348,24 @@ void read_config()
              sprintf( message, "Button reading interval set to %d s", (int)value);
              syslog( LOG_INFO | LOG_DAEMON, "%s", message);
           }
+          if( strncmp( par, "BUTTONMIN", 9) == 0 )
+          {
+             buttonmin = value;
+             sprintf( message, "Minimum button reading interval set to %4.2f s", value);
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+          }
+          if( strncmp( par, "BUTTONIDLE", 10) == 0 )
+          {
+             buttonidle = (int)value;
+             sprintf( message, "Idle button reading interval set to %d s", (int)value);
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+          }
+          if( strncmp( par, "BUTTONGPIO", 10) == 0 )
+          {
+             buttongpio = (int)value;
+             sprintf( message, "Push button interrupt from GPIO %d", (int)value);
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+          }
           if( strncmp( par, "CONFDELAY", 9) == 0 )
           {
              confdelay = (int)value;
@@ -336,12 +378,24 @@ void read_config()
              sprintf( message, "Delay to power down set to %d cycles", (int)value);
              syslog( LOG_INFO | LOG_DAEMON, "%s", message);
           }
+          if( strncmp( par, "CLOCKINT", 8 ) == 0 )
+          {
+             clockint = (int)value;
+             sprintf( message, "PIC cycle estimate counter reading interval %d s", (int)value);
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+          }
           if( strncmp( par, "PICYCLE", 7) == 0 )
           {
              picycle = value;
              sprintf( message, "PIC cycle %f s", value);
              syslog( LOG_INFO | LOG_DAEMON, "%s", message);
           }
+          if( strncmp( par, "BATTFILES", 9) == 0 )
+          {
+             battfiles = (int)value;
+             sprintf( message, "battery files written at most every %d s", (int)value );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+          }
           if( strncmp( par, "COUNTINT", 8) == 0 )
           {
              countint = (int)value;
@@ -445,6 +499,16 @@ void read_config()
                 syslog( LOG_INFO | LOG_DAEMON, "Do not set system time from PIC counter");
              }
           }
+          if( strncmp( par, "I2CRDWR", 7 ) == 0 )
+          {
+             i2cses.rdwr = (int)value;
+             if( i2cses.rdwr == 1 ) syslog( LOG_INFO | LOG_DAEMON, "Combined i2c command and reply with repeated start" );
+          }
+          if( strncmp( par, "I2CBUSD", 7 ) == 0 )
+          {
+             i2cses.busd = (int)value;
+             if( i2cses.busd == 1 ) syslog( LOG_INFO | LOG_DAEMON, "i2c transfers through pipicbusd" );
+          }
           if( strncmp( par, "FORCERESET", 10) == 0 )
           {
              if( value == 1 )
@@ -504,30 +568,71 @@ int read_wakeup()
   return wtime;
 }
 
-// read voltage from PIC AN3
-int readvolts()
+// read AN3 'voltsamples' times in one burst after GP5 has been set and
+// the voltage has settled, the first conversion is not used, GP5 is set
+// again in the burst in case it was cleared meanwhile and cleared at the
+// end of the burst unless the red LED on the same pin should stay on with
+// 'ledon', with firmware command 0x44 the conversions are summed on PIC
+// and read in one reply
+// return: mean reading or -1, noise is the standard deviation of readings
+// or half of their range when summed on PIC
+float readvolts(float *noise, int ledon)
 {
-  int volts = -1;
+  int i, ok;
+  int n = 0;
+  int val[ VOLTSAMPLEMAX + 1 ];
+  struct adcsum adc;
+  float mean = -1;
+  float var = 0;
+
+  *noise = 0;
+
+  ok = i2c_session_lock( &i2cses );
 
 // set GP5=1
   if( write_cmd( 0x25, 0, 0) != 1 ) syslog( LOG_ERR | LOG_DAEMON, "failed to set GP5=1");
-  sleep( 1 );
 
-// read AN3
-  if( write_cmd( 0x43, 0, 0) != 1 ) syslog( LOG_ERR | LOG_DAEMON, "failed send read AN3 command");
-  else volts = read_data( 2 );
-  sleep( 1 );
-
-// read again AN3
-  if( write_cmd( 0x43, 0, 0) != 1 ) syslog( LOG_ERR | LOG_DAEMON, "failed send read AN3 command");
-  else volts = read_data( 2 );
-  sleep( 1 );
+// read AN3 summed on PIC, otherwise each conversion separately and the
+// first one is not reliable
+  if( adcsumok == 1 )
+  {
+    if( read_adc( 3, voltsamples, &adc ) != 1 ) adc.n = 0;
+  }
+  else n = transact_repeat( 0x43, 0, 0, 2, val, voltsamples + 1 );
 
 // reset GP5=0
-  if( write_cmd( 0x15, 0, 0) != 1 ) syslog( LOG_ERR | LOG_DAEMON, "failed to clear GP5=0");
-  sleep( 1 );
+  if( ledon == 0 && write_cmd( 0x15, 0, 0) != 1 ) syslog( LOG_ERR | LOG_DAEMON, "failed to clear GP5=0");
+
+  if( ok == 1 ) i2c_session_unlock( &i2cses );
 
-  return volts;
+  if( adcsumok == 1 )
+  {
+    if( adc.n < 1 )
+    {
+      syslog( LOG_ERR | LOG_DAEMON, "failed to read AN3");
+      return mean;
+    }
+    mean = (float)adc.sum / adc.n;
+    *noise = ( adc.max - adc.min ) / 2.0;
+    syslog( LOG_DEBUG, "AN3 %5.1f noise %4.1f from %d conversions on PIC", mean, *noise, adc.n);
+    return mean;
+  }
+
+  if( n < 2 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "failed to read AN3");
+    return mean;
+  }
+
+  mean = 0;
+  for( i = 1; i < n; i++ ) mean += val[ i ];
+  mean /= n - 1;
+  for( i = 1; i < n; i++ ) var += ( val[ i ] - mean ) * ( val[ i ] - mean );
+  if( n > 2 ) *noise = sqrtf( var / ( n - 2 ) );
+
+  syslog( LOG_DEBUG, "AN3 %5.1f noise %4.1f from %d conversions", mean, *noise, n - 1);
+
+  return mean;
 }
 
 // disable event tasks
@@ -563,29 +668,31 @@ int reset_event_register()
 // check if power button has been pressed
 int read_button()
 {
-  int ok = -1;
   int pressed = -1;
 
-  ok = write_cmd( 0xA2, 0, 0); // read event register
-  if( ok == 1 ) pressed = read_data( 1 );
+  pressed = transact( 0xA2, 0, 0, 1 ); // read event register
 
   return pressed;
 }
 
-// power down after delay, optionally power up in future
+// power down after delay, optionally power up in future, all commands are
+// sent in one batch
 int powerdown(int delay, int pwrup)  
 {
   int ok;
   int wdelay = 0;
   int updelay = 0;
+  struct cmdbatch batch;
 
   sprintf( message, "power down after %d counts", delay);
   syslog( LOG_WARNING, "%s", message);
 
+  cmdbatch_init( &batch );
+
 // timed task1
-  ok = write_cmd( 0x62, delay, 4);
-  ok *= write_cmd( 0x63, 4607, 2);
-  ok *= write_cmd( 0x64, 0, 1);
+  cmdbatch_add( &batch, 0x62, delay, 4);
+  cmdbatch_add( &batch, 0x63, 4607, 2);
+  cmdbatch_add( &batch, 0x64, 0, 1);
 
 // optional timed task2 if '/var/lib/pipicpowerd/wakeup' exists
   if( pwrup == 1 )
@@ -596,24 +703,26 @@ int powerdown(int delay, int pwrup)
       updelay = (int)( wdelay / picycle );
       sprintf( message, "power up after %d counts", updelay);
       syslog( LOG_WARNING, "%s", message);
-      ok *= write_cmd( 0x72, updelay, 4);
-      ok *= write_cmd( 0x73, 8703, 2);
-      ok *= write_cmd( 0x74, 0, 1);
-      ok *= write_cmd( 0x71, 0, 0); // start task2
+      cmdbatch_add( &batch, 0x72, updelay, 4);
+      cmdbatch_add( &batch, 0x73, 8703, 2);
+      cmdbatch_add( &batch, 0x74, 0, 1);
+      cmdbatch_add( &batch, 0x71, 0, 0); // start task2
     }
   }
   else if( pwrup > 0 ) // watch dog power up for reboot
   {
     sprintf( message, "power up after %d counts", pwrup);
     syslog( LOG_WARNING, "%s", message);
-    ok *= write_cmd( 0x72, pwrup, 4);
-    ok *= write_cmd( 0x73, 8703, 2);
-    ok *= write_cmd( 0x74, 0, 1);
-    ok *= write_cmd( 0x71, 0, 0); // start task2
+    cmdbatch_add( &batch, 0x72, pwrup, 4);
+    cmdbatch_add( &batch, 0x73, 8703, 2);
+    cmdbatch_add( &batch, 0x74, 0, 1);
+    cmdbatch_add( &batch, 0x71, 0, 0); // start task2
   }
 
-  ok *= button_powerup();
-  ok *= write_cmd( 0x61, 0, 0); // start task1
+  cmdbatch_add( &batch, 0xA1, 0, 0); // re-enable event tasks for button
+  cmdbatch_add( &batch, 0x61, 0, 0); // start task1
+
+  ok = cmdbatch_flush( &batch );
 
   return ok;
 }
@@ -622,10 +731,12 @@ int powerdown(int delay, int pwrup)
 int read_timer()
 {
   int timer = -1;
+  double t;
 
-  if( write_cmd( 0x51, 0, 0) != 1 ) 
-    syslog( LOG_ERR | LOG_DAEMON, "failed to send read timer command");
-  else timer = read_data( 4 );
+  t = evloop_now();
+  timer = transact( 0x51, 0, 0, 4 );
+  if( timer < 0 ) syslog( LOG_ERR | LOG_DAEMON, "failed to read timer");
+  else if( clockint > 0 && picclock_sample( &pclock, timer, 0.5 * ( t + evloop_now() ) ) == 1 ) picycle = pclock.cycle;
 
   return timer;
 }
@@ -640,6 +751,7 @@ int resetimer()
   FILE *timefile;
 
   ok = write_cmd( 0x50, 0, 0);
+  picclock_reset( &pclock );
 
   time( &now );
   tm_info = localtime( &now );
@@ -691,160 +803,110 @@ int read_timer_file()
       sprintf( message, "reading %s failed", timerfile);
       syslog( LOG_ERR | LOG_DAEMON, "%s", message);
     }
+    fclose( tfile );
   }
 
   return timer;
 }
 
-// test if RTC or NTP is available
+// test if RTC or NTP is available, the answer is kept until the system
+// clock is set
 int test_ntp_rtc()
 {
-  int ntp_rtc = 0;
-
-  char str[ 250 ] = "/usr/bin/timedatectl --property=NTP --value show > /tmp/pipicpowerd_ntp_test";
-  int ok = system( str );
-
-  FILE *nfile;
-  char *line = NULL;
-  char p[ 200 ];
-  size_t len;
-  ssize_t read;
-
-  line = malloc( 200 * sizeof(char) );
-
-  if( ok != -1 )
-  {
-    nfile = fopen( "/tmp/pipicpowerd_ntp_test", "r");
-
-    if( NULL != nfile  )
-    {
-      if( (read = getline( &line, &len, nfile ) ) != -1 )
-      {
-        if( sscanf( line, "%s", p ) != EOF )
-        {
-          syslog( LOG_INFO | LOG_DAEMON, "NTP=%s", line);
-      	  if( strncmp( p, "yes", 3 ) == 0 ) ntp_rtc = 1;
-        }
-      }
-    }
-
-    fclose( nfile );
-  }
-
-  if( ntp_rtc == 0 )
-    syslog( LOG_INFO | LOG_DAEMON, "test 'timedatectl --property=NTP --value show > /tmp/pipicpowerd_ntp_test' failed");
-  else
-    syslog( LOG_INFO | LOG_DAEMON, "test 'timedatectl --property=NTP --value show > /tmp/pipicpowerd_ntp_test' success");
-
-  char str2[ 250 ] = "/usr/bin/timedatectl --property=LocalRTC --value show > /tmp/pipicpowerd_rtc_test";
-  ok = system( str2 );
-
-  if( ok != -1 )
-  {
-    nfile = fopen( "/tmp/pipicpowerd_rtc_test", "r");
-
-    if( NULL != nfile  )
-    {
-      if( (read = getline( &line, &len, nfile ) ) != -1 )
-      {
-        if( sscanf( line, "%s", p ) != EOF )
-        {
-          syslog( LOG_INFO | LOG_DAEMON, "LocalRTC=%s", line);
+  return clockchk_ntp_rtc();
+}
 
-          if( strncmp( p, "yes", 3 ) == 0 ) 
-          {
-            syslog( LOG_INFO | LOG_DAEMON, "test 'timedatectl --property=LocalRTC --value show > /tmp/pipicpowerd_rtc_test' success");
-            ntp_rtc = 1;
-	  }
-          else
-          {
-            syslog( LOG_INFO | LOG_DAEMON, "test 'timedatectl --property=LocalRTC --value show > /tmp/pipicpowerd_rtc_test' failed");
-          }
-	}
-      }
-    }
-    fclose( nfile );
-  }
+// test if the kernel clock is synchronized by NTP
+int test_ntp()
+{
+  int ntpruns = clockchk_synced();
 
-  free( line );
+  if( ntpruns == 0 )
+    syslog( LOG_INFO | LOG_DAEMON, "clock not synchronized by NTP");
 
-  return ntp_rtc;
+  return ntpruns;
 }
 
-// test if ntp is running
-int test_ntp()
+// write calculated wakeup time to file for information
+int writeuptime(time_t wake)
 {
-  int ntpruns = 0;
-
-  char str[250] = "/usr/bin/ntpq -p > /tmp/pipicpowerd_ntp_test";
-  int ok = system( str );
+  int ok = 0;
+  char str[ 250 ];
 
-  FILE *nfile;
-  char *line = NULL;
-  char p1[200], p2[200], p3[200], p4[200], p5[200], p6[200], p7[200], p8[200], p9[200], p10[200];
-  size_t len;
-  ssize_t read;
+// same format as from date --iso-8601='second'
+  struct tm* tm_info = localtime( &wake );
+  strftime( str, 250, "%Y-%m-%dT%H:%M:%S", tm_info );
 
-  line = malloc( sizeof(char) * 200 );
-  nfile = fopen( "/tmp/pipicpowerd_ntp_test", "r");
-  if( ( NULL != nfile ) && ( ok != -1 ) )
+  FILE *wfile = fopen( upfile, "w");
+  if( NULL == wfile )
   {
-    if( (read = getline( &line, &len, nfile ) ) != -1 )
-    {
-      if( sscanf( line, "%s %s %s %s %s %s %s %s %s %s", p1, p2, p3, p4, p5, p6, p7, p8, p9, p10 ) != EOF )
-      {
-        if( (strncmp( p1, "remote", 6 ) == 0 ) && ( strncmp( p2, "refid", 5) == 0 ) )
-        {
-          if( (read = getline( &line, &len, nfile) ) != -1 )
-          {
-            if( (read = getline( &line, &len, nfile) ) != -1 )
-            {
-              if( sscanf(line, "%s %s %s %s %s %s %s %s %s %s",p1, p2, p3, p4, p5, p6, p7, p8, p9, p10) != EOF )
-              {
-                ntpruns = 1;
-                syslog( LOG_INFO | LOG_DAEMON, "%s", line);
-              }
-            }
-          }
-        }
-      }
-    }
-    fclose( nfile );
+    sprintf( message, "could not write file: %s", upfile);
+    syslog( LOG_ERR | LOG_DAEMON, "%s", message);
+    return -1;
   }
+  fprintf( wfile, "%s%+03ld:%02ld\n", str, tm_info->tm_gmtoff / 3600, labs( tm_info->tm_gmtoff ) % 3600 / 60 );
+  fclose( wfile );
 
-  if( ntpruns == 0 )
-    syslog( LOG_INFO | LOG_DAEMON, "test 'ntpq -p > /tmp/pipicpowerd_ntp_test' failed");
-  else
-    syslog( LOG_INFO | LOG_DAEMON, "test 'ntpq -p > /tmp/pipicpowerd_ntp_test' success");
-  free( line );
-
-  return ntpruns;
+  return ok;
 }
 
-// write calculated wakeup time using PIC internal timer count 
-int writeuptime(int timer)
+// restore system time at power up from the PIC timer counts since the
+// timer was saved to file, the modification time of the file tells when
+// the timer was read, the time is not touched if the timer could not be
+// read or has been reset
+// return: 1=ok, 0=setting time disabled, -1=failed or time not set
+int restoretime(int timer)
 {
   int ok = 0;
-  int timer0 = read_timer_file(); 
-  int s = (int)( (timer-timer0) * picycle );
-  int h = (int)( s / 3600 );
-  int m = (int)( ( s % 3600 ) / 60 );
-  int ss = (int)( ( s % 3600 ) % 60 );
-  char str[ 250 ];
+  int timer0 = 0;
+  double s = 0;
+  struct stat st;
+  struct timespec ts;
+  char str[ 100 ];
 
+  if( stat( timerfile, &st ) == -1 )
+  {
+    sprintf( message, "could not read file: %s", timerfile);
+    syslog( LOG_ERR | LOG_DAEMON, "%s", message);
+    return -1;
+  }
+  timer0 = read_timer_file();
+
+  if( timer < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "PIC timer not read, system time not set");
+    return -1;
+  }
   if( timer < timer0 )
   {
-    h = 0;
-    m = 0;
-    ss = 0;
     sprintf( str, "timer0=%d has higher value than timer=%d!", timer0, timer);
     syslog( LOG_ERR | LOG_DAEMON, "%s", str);
-    syslog( LOG_ERR | LOG_DAEMON, "force hours=0, minutes=0 and seconds=0");
+    syslog( LOG_ERR | LOG_DAEMON, "PIC timer has been reset, system time not set");
+    return -1;
+  }
+  s = ( timer - timer0 ) * picycle;
+
+  ts = st.st_mtim;
+  ts.tv_sec += (time_t)s;
+  ts.tv_nsec += (long)( 1e9 * ( s - floor( s ) ) );
+  if( ts.tv_nsec >= 1000000000 )
+  {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
   }
 
-  sprintf( str, "date --date='%d hours %d minutes %d seconds' --iso-8601='second' > /var/lib/pipicpowerd/waketime", h, m, ss);
-  syslog( LOG_DEBUG, "%s", str);
-  ok = system( str );
+  if( settime == 1 ) ok = sysact_settime( &ts );
+
+  strftime( str, 100, "%Y-%m-%d %H:%M:%S", localtime( &ts.tv_sec ) );
+  sprintf( message, "%d timer counts in %.0f s since timer was saved, time now %s", timer - timer0, s, str);
+  syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+  if( settime == 0 )
+  {
+    sprintf( message, "system time can be set with /usr/bin/timedatectl set-time '%s'", str);
+    syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+  }
+
+  writeuptime( ts.tv_sec );
 
   return ok;
 }
@@ -891,13 +953,23 @@ void stop(int sig)
   cont = 0;
 }
 
+volatile sig_atomic_t termsig = 0; // 1=SIGTERM received
+
+// the power down is done from the main loop after SIGTERM so that the
+// handler does not use the i2c session in the middle of a transfer
 void terminate(int sig)
+{
+  termsig = 1;
+  cont = 0;
+}
+
+// program PIC power down and save the timer as requested with 'pwroff'
+void powerdown_exit()
 {
   int ok = 0;
   int timer = 0;
 
-  sprintf( message, "signal %d catched", sig);
-  syslog( LOG_NOTICE | LOG_DAEMON, "%s", message);
+  syslog( LOG_NOTICE | LOG_DAEMON, "signal %d catched", SIGTERM);
 
 // 1 SIGTERM causes power off
   if( pwroff == 1 )
@@ -945,18 +1017,25 @@ void terminate(int sig)
 
   sleep( 1 );
   syslog( LOG_NOTICE | LOG_DAEMON, "stop");
-  cont = 0;
 }
 
-// shut down and power off if '/var/lib/pipicpowerd/pwrdown' exists
+volatile sig_atomic_t hupsig = 0; // 1=SIGHUP received
+
+// the shut down is done from the main loop after SIGHUP
 void hup(int sig)
+{
+  hupsig = 1;
+}
+
+// shut down and power off if '/var/lib/pipicpowerd/pwrdown' exists
+void hup_powerdown()
 {
   int timer = 0;
 
-  sprintf( message, "signal %d catched", sig);
-  syslog( LOG_NOTICE | LOG_DAEMON, "%s", message);
+  syslog( LOG_NOTICE | LOG_DAEMON, "signal %d catched", SIGHUP);
 
-  if( access( pdownfile, F_OK ) != -1 )
+  if( ctlfd < 0 ) pdownok = ( access( pdownfile, F_OK ) != -1 );
+  if( pdownok == 1 )
   {
     syslog( LOG_NOTICE, "shut down and power off");
     sleep( 1 );
@@ -972,68 +1051,43 @@ void hup(int sig)
     if( pwrupfile_create() != 1 )
       syslog( LOG_ERR | LOG_DAEMON, "failed to create 'pwrup' file");
     cont = 0;
-    if( system( "/bin/sync" ) == -1 )
-      syslog( LOG_ERR | LOG_DAEMON, "sync to disk failed");
-    if( system( "/sbin/shutdown -h now" ) == -1 )
-      syslog( LOG_ERR | LOG_DAEMON, "system shutdown failed");
+    sysact_sync();
+    sysact_power( SYSACT_POWEROFF, 0, NULL );
   }
 }
 
-// read sleep time from file if it exists, if the time matches local time
-// shutdown and power down is started
+// read sleep time hh:mm from file if it exists
+// return: minutes from midnight, -1=no sleep time
 int read_sleeptime()
 {
-  int sleepnow = 0;
-  int hh = 0,mm = 0, mins;
+  int hh = 0, mm = 0, mins = -1;
   FILE *sfile;
 
-  time_t now;
-  struct tm* tm_info;
-  time( &now );
-  tm_info = localtime( &now );
-
-  int hour = tm_info->tm_hour;
-  int minute = tm_info->tm_min; 
-  int minutes = 60*hour+minute;
-
   sfile = fopen( sleepfile, "r");
   if( NULL != sfile )
   {
-    if( fscanf( sfile, "%d:%d", &hh, &mm) != EOF )
-    {
-      mins = 60 * hh + mm;
-      if( ( minutes >= mins) && ( ( minutes-mins)<3) ) sleepnow = 1;
-    }
+    if( fscanf( sfile, "%d:%d", &hh, &mm) >= 1 ) mins = 60 * hh + mm;
     fclose( sfile );
   }
 
-  return sleepnow;
+  return mins;
 }
 
-// read maximum power up time from file if it exists and compare to uptime
-// calculated from PIC counter, this is used for cyclic operation
-int read_puptime(int timerstart)
+// read maximum power up time in minutes from file if it exists, this is
+// used for cyclic operation
+int read_puptime()
 {
-  int sleepnow = 0;
   int mins = 0;
-  int timer = 0;
   FILE *pfile;
 
   pfile = fopen( puptimefile, "r");
   if( NULL != pfile )
   {
-    if( fscanf( pfile, "%d", &mins ) != EOF )
-    {
-      if( mins > 2 )
-      {
-        timer = read_timer();      
-        if( ( ( (timer-timerstart) * picycle )/60 - 1 ) > mins ) sleepnow = 1;
-      }
-    }
+    if( fscanf( pfile, "%d", &mins ) != 1 ) mins = 0;
     fclose( pfile );
   }
 
-  return sleepnow;
+  return mins;
 }
 
 // read power down time in minutes from file for cyclic operation
@@ -1056,7 +1110,8 @@ int read_pdowntime()
 }
 
 // write '/var/lib/pipicpowerd/battery', '/var/lib/pipicpowerd/volts'
-// and '/var/lib/pipicpowerd/hoursleft'
+// and '/var/lib/pipicpowerd/hoursleft' for old readers, the same values
+// are in the shared battery state after each reading
 int write_battery(int b, float v, float h, float t, float l)
 {
   int ok = 0;
@@ -1251,37 +1306,571 @@ int read_wifi()
 }
 
 
-int main()
-{  
+struct evloop ev; // event loop running the daemon tasks
+int statfd = -1; // i2c statistics socket
+int ifuptask = -1; // task to bring WiFi interface up again
+
+// statistics for this power up
+float temp = -100; // ambient temperature [C]
+float Vmin = 100; // minimum voltage for statistics
+float Vmax = -100; // maximun voltage for statistics
+float Vave = 0; // average voltage
+float Vaven = 0; // number of samples to calculate average voltage
+float Tmin = 100; // minimum temperature for statistics
+float Tmax = -100; // maximun temperature for statistics
+float Tave = 0; // average temperature
+float Taven = 0; // number of samples to calculate average temperature
+float Tcpumin = 100; // minimum CPU temperature for statistics
+float Tcpumax = -100; // maximun CPU temperature for statistics
+float Tcpuave = 0; // average CPU temperature
+float Tcpuaven = 0; // number of samples to calculate average CPU temperature
+int timerstart = 0; // first timer value from PIC
+unsigned unxstart = 0; // for power up statistics
+int wifidown = 0; // time WiFi has been down [s]
+int wifiuptime = 0; // time WiFi has been up [s]
+int confwait = 0; // 1=waiting for button press to confirm shutdown
+int buttontask = -1; // task to read push button
+int sleeptask = -1; // task to shut down at sleep time
+int pdowntask = -1; // task to end power up time in cyclic operation
+double timerstartmono = 0; // monotonic time of first timer reading [s]
+double buttondelay = 10; // current button reading interval [s]
+double buttonactive = 0; // time of last button activity [s]
+int buttonwired = 0; // 1=button edges come from GPIO line
+double presstime = 0; // time of first button press [s]
+int voltstate = 0; // 1=GP5 set and waiting for the voltage to settle
+
+// run optional power down script and start system shut down after 'mins'
+// minutes with optional message, the PIC is powered down according to
+// 'mode' in powerdown_exit() after the main loop has stopped on SIGTERM
+void shutdown_system(int mode, int mins, const char *msg)
+{
+  if( access( atpwrdown, X_OK ) != -1 )
+  {
+    sprintf( message, "execute power down script %s", atpwrdown);
+    syslog( LOG_NOTICE, "%s", message);
+    sysact_run( atpwrdown );
+    sleep( 5 );
+  }
+  pwroff = mode;
+  sysact_sync();
+  sysact_power( SYSACT_POWEROFF, mins, msg );
+}
+
+// the tasks below are run from the event loop, each returns the delay to
+// its next run in seconds or -1 when it should not run again
+
+// start time for statistics after the system time has been set
+double task_start()
+{
+  unxstart = time( NULL ) - 15;
+
+  return -1;
+}
+
+// seconds to the sleep time or 0 during three minutes from it, the delay
+// is computed again at least every SLEEPDELAYMAX seconds to follow
+// daylight saving time changes
+// return: delay [s], -1=no sleep time
+double sleep_delay()
+{
+  time_t now = time( NULL );
+  struct tm* tm_info = localtime( &now );
+  double d;
+
+  if( sleepmins < 0 ) return -1;
+
+  d = 60 * sleepmins - ( 3600 * tm_info->tm_hour + 60 * tm_info->tm_min + tm_info->tm_sec );
+  if( d <= -180 ) d += 24 * 3600;
+  if( d < 0 ) d = 0;
+  if( d > SLEEPDELAYMAX ) d = SLEEPDELAYMAX;
+
+  return d;
+}
+
+// seconds to the end of maximum power up time in cyclic operation from the
+// monotonic clock, the PIC timer is read when it is due
+// return: delay [s], -1=no limit
+double pdown_delay()
+{
+  double d;
+
+  if( pupmins <= 2 ) return -1;
+
+  d = timerstartmono + 60 * ( pupmins + 1 ) - evloop_now();
+
+  return ( d < 0 ) ? 0 : d;
+}
+
+// check maximum power up time in cyclic operation
+double task_pdown()
+{
+  double up;
+  int timer;
+
+  if( pwroff != 0 ) return -1;
+
+  if( ctlfd < 0 ) pupmins = read_puptime();
+  if( pupmins <= 2 ) return ( ctlfd < 0 ) ? CTLPOLL : -1;
+
+  if( solarpwr == 1 && battfull == 1 )
+  {
+    syslog( LOG_NOTICE | LOG_DAEMON, "battery full, no power down");
+    return voltint;
+  }
+
+  timer = read_timer();
+  if( timer < 0 ) return CTLPOLL; // PIC not answering, try again later
+
+  up = ( timer - timerstart ) * picycle;
+  if( ( up / 60 - 1 ) > pupmins )
+  {
+    syslog( LOG_NOTICE, "time to go to sleep");
+    if( ctlfd < 0 ) pdownmins = read_pdowntime();
+    downmins = pdownmins;
+    shutdown_system( 4, 1, NULL );
+    return -1;
+  }
+
+  return 60 * ( pupmins + 1 ) - up + 1;
+}
+
+// shut down at sleep time
+double task_sleep()
+{
+  double d;
+
+  if( pwroff != 0 ) return -1;
+
+  if( ctlfd < 0 ) sleepmins = read_sleeptime();
+  d = sleep_delay();
+  if( d == 0 )
+  {
+    syslog( LOG_NOTICE, "time to go to sleep");
+    shutdown_system( 1, 0, NULL );
+    return -1;
+  }
+  if( ctlfd < 0 && ( d < 0 || d > CTLPOLL ) ) d = CTLPOLL;
+
+  return d;
+}
+
+// read battery voltage and temperatures, the task first sets GP5 and
+// runs again after 'voltsettle' ms to read AN3
+double task_volts()
+{
   int volts = -1; // voltage reading
+  float an3 = -1; // mean AN3 reading
+  float noise = 0; // AN3 noise
+  double settle = voltsettle / 1000.0;
   float voltsV = 0; // conversion to Volts
   float battlev = 0; // battery level [%]
   float batim = 0; // hours left with battery
   float ophours = 0; // hours left before recommended low charge level reached
-  float temp = -100; // ambient temperature [C]
   float cputemp = -100; // CPU temperature
-  float Vmin = 100; // minimum voltage for statistics
-  float Vmax = -100; // maximun voltage for statistics
-  float Vave = 0; // average voltage
-  float Vaven = 0; // number of samples to calculate average voltage
-  float Tmin = 100; // minimum temperature for statistics
-  float Tmax = -100; // maximun temperature for statistics
-  float Tave = 0; // average temperature
-  float Taven = 0; // number of samples to calculate average temperature
-  float Tcpumin = 100; // minimum CPU temperature for statistics
-  float Tcpumax = -100; // maximun CPU temperature for statistics
-  float Tcpuave = 0; // average CPU temperature
-  float Tcpuaven = 0; // number of samples to calculate average CPU temperature
-
-  int button = 0; // button pressed
+
+  if( pwroff != 0 )
+  {
+// reset GP5=0 if left set for a reading that was not done
+    if( voltstate == 1 && confwait == 0 ) write_cmd( 0x15, 0, 0);
+    voltstate = 0;
+    return -1;
+  }
+
+  if( settle > voltint / 2 ) settle = voltint / 2;
+
+  if( voltstate == 0 )
+  {
+// set GP5=1
+    if( write_cmd( 0x25, 0, 0) != 1 ) syslog( LOG_ERR | LOG_DAEMON, "failed to set GP5=1");
+    voltstate = 1;
+    return settle;
+  }
+  voltstate = 0;
+
+  an3 = readvolts( &noise, confwait );
+  volts = (int)( an3 + 0.5 );
+  if( an3 < 0 ) volts = -1;
+  if( volttempa != 0 ) temp = readtemp();
+  if( temp > -100 && temp < 100 && volttempa != 0 ) voltcal = volttempa * temp * temp + volttempb * temp + volttempc;
+  voltsV = voltcal * ( 1023 - an3 ) + vdrop;
+  if( voltsV < Vmin ) Vmin = voltsV;
+  if( voltsV > Vmax ) Vmax = voltsV;
+  Vave += voltsV;
+  Vaven++;
+  if( temp > -100 && temp < 100 ) 
+  {
+    if( temp < Tmin ) Tmin = temp;
+    if( temp > Tmax)  Tmax = temp;
+    Tave += temp;
+    Taven++;
+  }
+  cputemp = readcputemp();
+  if( cputemp > -100 ) 
+  {
+    if( cputemp < Tcpumin ) Tcpumin = cputemp;
+    if( cputemp > Tcpumax ) Tcpumax = cputemp;
+    Tcpuave += cputemp;
+    Tcpuaven++;
+  }
+
+  battlev = battlevel( voltsV );
+  if( battlev >= 95 ) 
+  {
+    if( battfull == 0 && solarpwr == 1 )
+      syslog( LOG_NOTICE, "battery full, stop cyclic power down");
+    battfull = 1;
+  }
+  if( battlev < 85 ) 
+  {
+    if( battfull == 1 && solarpwr == 1 )
+      syslog( LOG_NOTICE, "battery not full any more, restart cyclic power down");
+    battfull = 0;
+  }
+  batim = battime( battlev, battcap, pkfact, phours, current);
+  sprintf( message, "read voltage %d (%4.1f V %3.0f %% %4.0f hours)", volts, voltsV, battlev, batim);
+  if( temp > -100 && temp < 100 && volttempa != 0 ) sprintf( message, "read voltage %d (%4.1f V %3.0f %% %4.0f hours at %4.1f C)", volts, voltsV, battlev, batim, temp);
+  syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+  ophours = optime( battlev, minbattlev, battcap, pkfact, phours, current);
+  battv.time = time( NULL );
+  battv.battery = volts;
+  battv.volts = voltsV;
+  battv.battlevel = battlev;
+  battv.hoursleft = batim;
+  battv.ophours = ophours;
+  battv.temp = ( temp > -100 && temp < 100 ) ? temp : -100;
+  battv.cputemp = cputemp;
+  battstate_write( battst, &battv );
+  if( battfiles > 0 && ( battfilestime < 0 || evloop_now() - battfilestime >= battfiles ) )
+  {
+    write_battery( volts, voltsV, batim, ophours, battlev);
+    battfilestime = evloop_now();
+  }
+  if(volts>minvolts)
+  {
+    syslog( LOG_WARNING, "battery voltage low %d, shut down and power off", volts);
+    shutdown_system( 2, 0, "battery low" );
+  }
+  if( battlev < minbattlev )
+  {
+    sprintf( message, "battery charge low %3.0f %%, shut down and power off", battlev);
+    syslog( LOG_WARNING, "%s", message);
+    shutdown_system( 1, 5, "battery charge low" );
+  }
+  if( voltsV > maxbattvolts )
+  {
+    syslog( LOG_WARNING, "too high charging voltage %4.1f V reached", voltsV);
+    if( sysact_wall( "too high charging voltage reached" ) != 1 )
+      syslog( LOG_ERR | LOG_DAEMON, "wall failed");
+  }
+  if( reset_event_register() != 1 )
+    syslog( LOG_ERR | LOG_DAEMON, "failed to reset event register");
+  if( reset_event_register() != 1 )
+    syslog( LOG_ERR | LOG_DAEMON, "failed to reset event register");
+
+  if( pwroff != 0 ) return -1;
+
+  return voltint - settle;
+}
+
+// check push button, after the first press the button is read once a
+// second for 'confdelay' seconds to wait for confirmation, when idle the
+// reading interval is doubled from 'buttonmin' up to 'buttonint' and after
+// 'buttonidle' seconds without activity up to 'buttonidle', with a GPIO
+// line the button is read after edges and only every BUTTONSAFE seconds
+// otherwise, the red LED is on GP5 with the voltage divider so it is not
+// switched while task_volts() waits on GP5 and readvolts() leaves GP5 as
+// 'confwait' wants it
+double task_button()
+{
+  int button = read_button();
+  double now = evloop_now();
+  double maxdelay = buttonint;
+
+  if( pwroff != 0 ) return -1;
+
+  if( confwait == 0 )
+  {
+    if( button == 0x01 || button == 0x81 )
+    {
+      syslog( LOG_NOTICE | LOG_DAEMON, "button pressed");
+      if( voltstate == 0 ) write_cmd( 0x25, 0, 0); // turn on red LED
+
+      if( reset_event_register() != 1 )
+        syslog( LOG_ERR | LOG_DAEMON, "failed to reset event register");
+      if( reset_event_register() != 1 )
+        syslog( LOG_ERR | LOG_DAEMON, "failed to reset event register");
+
+      confwait = 1;
+      presstime = now;
+      buttonactive = now;
+      buttondelay = buttonmin;
+      if( buttonwired == 1 ) return confdelay + 0.1;
+      return 1;
+    }
+
+    if( buttonwired == 1 ) return BUTTONSAFE;
+
+    if( now - buttonactive > buttonidle ) maxdelay = buttonidle;
+    buttondelay *= 2;
+    if( buttondelay > maxdelay ) buttondelay = maxdelay;
+    if( buttondelay < buttonmin ) buttondelay = buttonmin;
+    return buttondelay;
+  }
+
+  if( button == 0x01 || button == 0x81 )
+  {
+    syslog( LOG_NOTICE, "shutdown confirmed" );
+    if( voltstate == 0 ) write_cmd( 0x15, 0, 0); // turn off red LED 
+    confwait = 0;
+    shutdown_system( 1, 0, NULL );
+    return -1;
+  }
+
+  if( now - presstime > confdelay )
+  {
+    if( voltstate == 0 ) write_cmd( 0x15, 0, 0); // turn off red LED
+    confwait = 0;
+    buttonactive = now;
+    if( buttonwired == 1 ) return BUTTONSAFE;
+    return buttondelay;
+  }
+
+// with GPIO line wait for the confirmation edge or the time out
+  if( buttonwired == 1 ) return presstime + confdelay + 0.1 - now;
+
+  return 1;
+}
+
+// request falling edge events from GPIO line wired to the push button
+// return: line event file descriptor or -1
+int button_gpio_open(int line)
+{
+  int fd;
+  struct gpioevent_request req;
+
+  fd = open( gpiochip, O_RDONLY | O_CLOEXEC );
+  if( fd < 0 )
+  {
+    sprintf( message, "could not open %s", gpiochip);
+    syslog( LOG_ERR | LOG_DAEMON, "%s", message);
+    return -1;
+  }
+
+  memset( &req, 0, sizeof(req) );
+  req.lineoffset = line;
+  req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+  req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+  strncpy( req.consumer_label, "pipicpowerd", sizeof(req.consumer_label) - 1 );
+
+  if( ioctl( fd, GPIO_GET_LINEEVENT_IOCTL, &req ) < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "could not request events from GPIO %d", line);
+    close( fd );
+    return -1;
+  }
+  close( fd );
+
+  return req.fd;
+}
+
+// push button edge on GPIO line, the button is read at once except during
+// the first second of confirmation wait to ignore contact bounce
+void button_edge(int fd)
+{
+  struct gpioevent_data ed;
+  double delay = 0;
+
+  if( read( fd, &ed, sizeof(ed) ) != sizeof(ed) ) return;
+
+  if( confwait == 1 ) delay = presstime + 1 - evloop_now();
+  if( delay < 0 ) delay = 0;
+  evloop_schedule( &ev, buttontask, delay );
+}
+
+// parse control file after it has changed and move the deadlines
+void control_changed(const char *name)
+{
+  if( strcmp( name, strrchr( sleepfile, '/' ) + 1 ) == 0 )
+  {
+    sleepmins = read_sleeptime();
+    if( sleepmins >= 0 ) sprintf( message, "sleep time %02d:%02d", sleepmins / 60, sleepmins % 60);
+    else sprintf( message, "no sleep time");
+    syslog( LOG_INFO | LOG_DAEMON, "%s", message);
+    evloop_schedule( &ev, sleeptask, sleep_delay() );
+  }
+  else if( strcmp( name, strrchr( puptimefile, '/' ) + 1 ) == 0 )
+  {
+    pupmins = read_puptime();
+    syslog( LOG_INFO | LOG_DAEMON, "maximum power up time %d min", pupmins);
+    evloop_schedule( &ev, pdowntask, pdown_delay() );
+  }
+  else if( strcmp( name, strrchr( pdowntimefile, '/' ) + 1 ) == 0 )
+  {
+    pdownmins = read_pdowntime();
+    syslog( LOG_INFO | LOG_DAEMON, "power down time %d min", pdownmins);
+  }
+  else if( strcmp( name, strrchr( pdownfile, '/' ) + 1 ) == 0 )
+  {
+    pdownok = ( access( pdownfile, F_OK ) != -1 );
+    syslog( LOG_INFO | LOG_DAEMON, "power down with SIGHUP %s", pdownok ? "allowed" : "not allowed");
+  }
+}
+
+// read all control files
+void read_controls()
+{
+  control_changed( strrchr( sleepfile, '/' ) + 1 );
+  control_changed( strrchr( puptimefile, '/' ) + 1 );
+  control_changed( strrchr( pdowntimefile, '/' ) + 1 );
+  control_changed( strrchr( pdownfile, '/' ) + 1 );
+}
+
+// watch control file directory, files are read only after they change
+// return: inotify file descriptor or -1
+int control_watch_open()
+{
+  int fd;
+
+  fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+  if( fd < 0 ) return -1;
+
+  if( inotify_add_watch( fd, ctldir, IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM ) < 0 )
+  {
+    sprintf( message, "could not watch %s", ctldir);
+    syslog( LOG_ERR | LOG_DAEMON, "%s", message);
+    close( fd );
+    return -1;
+  }
+
+  return fd;
+}
+
+// changes in control file directory
+void control_event(int fd)
+{
+  char buf[ 4096 ] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *ie;
+  char *p;
+  ssize_t n;
+
+  while( ( n = read( fd, buf, sizeof(buf) ) ) > 0 )
+  {
+    for( p = buf; p < buf + n; p += sizeof(struct inotify_event) + ie->len )
+    {
+      ie = (const struct inotify_event *)p;
+      if( ie->len > 0 ) control_changed( ie->name );
+    }
+  }
+}
+
+// system clock was set, move the sleep time deadline
+void clock_set(int fd)
+{
+  clockchk_event( fd );
+  evloop_schedule( &ev, sleeptask, sleep_delay() );
+}
+
+// put PIC counter to shared battery state, not called from signal handlers
+// since there is only one writer
+void battstate_timer(int timer)
+{
+  battv.timertime = time( NULL );
+  battv.timer = timer;
+  battstate_write( battst, &battv );
+}
+
+// save PIC counter to file
+double task_counter()
+{
+  int timer = 0;
+
+  if( pwroff != 0 ) return -1;
+
+  timer = read_timer();
+  syslog( LOG_INFO | LOG_DAEMON, "PIC timer at %d", timer );
+  write_timer( timer );
+  battstate_timer( timer );
+
+  return countint;
+}
+
+// read PIC counter to follow the cycle length
+double task_clock()
+{
+  if( pwroff != 0 ) return -1;
+
+  battstate_timer( read_timer() );
+
+  return clockint;
+}
+
+// check WiFi state and act if it has been down too long
+double task_wifi()
+{
+  int wifiup = 0; // WiFi 0=unknown,-1=down, +1=up
+
+  if( pwroff != 0 ) return -1;
+
+  wifiup = read_wifi();
+  syslog( LOG_INFO | LOG_DAEMON, "WiFi status %d", wifiup);
+  if( wifiup == 1 ) 
+  {
+    wifiuptime += wifint;
+    wifidown = 0;
+  }
+  else if( wifiup == -1 ) wifidown += wifint;
+
+  if( wifiup == -1 && wifidown > wifitimeout )
+  {
+    if( wifiact == 1 )
+    {
+      syslog( LOG_NOTICE, "interface down" );
+      sysact_ifdown( "wlan0" );
+      evloop_schedule( &ev, ifuptask, 10 );
+    }
+    else if( wifiact == 2 )
+    {
+      syslog( LOG_WARNING, "reboot system" );
+      sysact_sync();
+      sysact_power( SYSACT_REBOOT, 0, NULL );
+    }
+    else if( wifiact == 3 )
+    {
+      syslog( LOG_WARNING, "power cycle system" );
+      pwroff = 3; 
+      sysact_sync();
+      sysact_power( SYSACT_POWEROFF, 0, NULL );
+    }
+    wifidown = 0;
+  }
+
+  return wifint;
+}
+
+// bring WiFi interface up 10 s after it was taken down
+double task_ifup()
+{
+  syslog( LOG_NOTICE, "interface up" );
+  sysact_ifup( "wlan0" );
+
+  return -1;
+}
+
+volatile sig_atomic_t dumpstats = 0; // 1=write i2c statistics to file
+
+// the statistics file is written from the main loop after SIGUSR1
+void usr1(int sig)
+{
+  dumpstats = 1;
+}
+
+int main()
+{  
   int timer = 0; // PIC internal timer
   int ntpok = 0; // does the ntpd seem to be running?
-  int wifiup = 0; // WiFi 0=unknown,-1=down, +1=up
+  int gpiofd = -1; // push button GPIO line events
+  int clockfd = -1; // readable when system clock is set
   int ok = 0;
-  char s[ 200 ];
-  char tzone[ 25 ];
-  int yy, mo, da, hh, mm, ss;
-  FILE *wakef;
 
   setlogmask( LOG_UPTO (loglev) );
   syslog( LOG_NOTICE | LOG_DAEMON, "pipicpowerd v. %d started", version);
@@ -1291,20 +1880,14 @@ int main()
   signal( SIGTERM, &terminate); 
   signal( SIGQUIT, &stop); 
   signal( SIGHUP, &hup); 
+  signal( SIGUSR1, &usr1); 
 
-  unsigned unxs = (int)time(NULL); // unix seconds
-  unsigned nxtvolts = unxs; // next time to read battery voltage
-  unsigned nxtstart = 15 + unxs; // next time to read start time
-  unsigned nxtbutton = 20 + unxs; // next time to check button
-  unsigned nxtpdown = 30 + unxs; // next time to check cyclic power down
-  unsigned nxtsleep = 60 + unxs; // next time to check sleep file
-  unsigned nxtcounter = 300 + unxs; // next time to read PIC counter
-
-  int timerstart = 0; // first timer value from PIC
+// opened before the first clock check so that no clock change is missed
+  clockfd = clockchk_open();
 
   read_config(); // read configuration file
-
-  unsigned nxtwifi = wifint + unxs; // next time to check WiFi status
+  picclock_init( &pclock, picycle, ( clockint > 0 ) ? cyclefile : NULL );
+  picycle = pclock.cycle;
 
   int i2cok = testi2c(); // test i2c data flow to PIC 
   if( i2cok == 1 ) syslog( LOG_NOTICE | LOG_DAEMON, "PIC i2c dataflow test ok");
@@ -1344,6 +1927,18 @@ int main()
 
   if( cont == 1 )
   {
+    timer = read_timer();
+    timerstart = timer;
+    timerstartmono = evloop_now();
+    syslog( LOG_INFO | LOG_DAEMON, "PIC timer at %d", timer);
+
+// the time is restored first so that services started after us see it
+//    ntpok = test_ntp();
+    ntpok = test_ntp_rtc();
+    if( access( pwrupfile, F_OK ) != -1  && ntpok == 0 ) ok = restoretime( timer );
+    else if( access( pwrupfile, F_OK ) == -1 )
+      syslog( LOG_NOTICE | LOG_DAEMON, "not power up, leave time untouched");
+
     syslog( LOG_NOTICE | LOG_DAEMON, "disable PIC event triggered tasks");
     if( event_task_disable() != 1 ) syslog( LOG_ERR | LOG_DAEMON, "failed to disable PIC event triggered tasks");
     sleep( 1 );
@@ -1362,39 +1957,7 @@ int main()
     sleep( 1 );
     ok = write_cmd( 0x70, 0, 0); // disable timed task 2
     sleep( 1 );
-    timer = read_timer();
-    timerstart = timer;
-    syslog( LOG_INFO | LOG_DAEMON, "PIC timer at %d", timer);
 
-//    ntpok = test_ntp();
-    ntpok = test_ntp_rtc();
-    if( access( pwrupfile, F_OK ) != -1  && ntpok == 0 )
-    {
-      ok = writeuptime( timer );
-      wakef = fopen( upfile, "r" );
-      if( NULL == wakef )
-      {
-        sprintf( message, "could not read file: %s", upfile);
-        syslog( LOG_ERR | LOG_DAEMON, "%s", message);
-      }
-      else
-      { 
-// '2020-12-29T17:19:14-06:00' from date --iso-8601='second'
-      	if( fscanf( wakef, "%d-%d-%dT%d:%d:%d%s", &yy, &mo, &da, &hh, &mm, &ss, tzone ) != EOF )
-        {
-          snprintf( s, 200, "/usr/bin/timedatectl set-time '%4d-%02d-%02d %02d:%02d:%02d'", yy, mo, da, hh, mm, ss );
-          syslog( LOG_INFO | LOG_DAEMON, "%s", s);
-          fclose( wakef );
-          if( settime == 1 )
-             ok = system( s );
-          else
-             syslog( LOG_INFO | LOG_DAEMON, "system time can be set with command above");
-        }
-      } 
-    }
-    else if( access( pwrupfile, F_OK ) == -1 )
-      syslog( LOG_NOTICE | LOG_DAEMON, "not power up, leave time untouched");
-    
     if( access( pwrupfile, F_OK ) != -1 )
     {
       ok = pwrupfile_delete();
@@ -1402,7 +1965,7 @@ int main()
       {
         sprintf( message, "execute power up script %s", atpwrup);
         syslog( LOG_NOTICE, "%s", message);
-        ok = system( atpwrup );
+        ok = sysact_run( atpwrup );
       }
     }
   }
@@ -1472,264 +2035,83 @@ int main()
     ok = powerdown( forceoff, forceon );
   }
 
-  unsigned unxstart = time( NULL ); // for power up statistics
+  unxstart = time( NULL ); // for power up statistics
   unsigned unxstop = 0;
 
-  if( solardays > 0 ) calcuptime( statfile, unxstart, solardays, solarcycle);
+  if( solardays > 0 ) calcuptime( unxstart, solardays, solarcycle);
 
-  int wifidown = 0;
-  int wifiuptime = 0;
-  int wtime = 0;
-  while( cont == 1 )
+  battst = battstate_create( battstatefile );
+  if( battst == NULL )
   {
-    unxs = (int)time( NULL ); 
-
-    if( unxs >= nxtstart && nxtstart > 0 )
-    {
-       unxstart = time( NULL ); 
-       unxstart -= 15;
-       nxtstart = 0;
-    }
-
-    if(( unxs >= nxtpdown ||( (nxtpdown - unxs) > voltint) )&& pwroff == 0 ) 
-    {
-      nxtpdown = pdownint + unxs;
-      if( solarpwr == 0 ||( solarpwr == 1 && battfull == 0 ) )
-      {
-        if( read_puptime( timerstart ) == 1 )
-        {
-          syslog( LOG_NOTICE, "time to go to sleep");
-          sleep( 1 );
-          if( access( atpwrdown, X_OK ) != -1 )
-          {
-            sprintf( message, "execute power down script %s", atpwrdown);
-            syslog( LOG_NOTICE, message); 
-            ok = system( atpwrdown );
-            sleep( 5 );
-          }
-          downmins = read_pdowntime();
-          pwroff = 4;
-          ok = system( "/bin/sync" );
-          ok = system( "/sbin/shutdown -h +1" );
-         }
-      }
-      else if( solarpwr == 1 && battfull == 1 )
-      {
-        syslog( LOG_NOTICE | LOG_DAEMON, "battery full, no power down");
-        nxtpdown = voltint + unxs - pdownint;
-      }
-    }
-
-    if( ( unxs >= nxtsleep || (nxtsleep - unxs) > sleepint )  && pwroff == 0 ) 
-    {
-      nxtsleep = sleepint + unxs;
-      if( read_sleeptime() == 1 )
-      {
-        syslog( LOG_NOTICE, "time to go to sleep");
-        sleep( 1 );
-        if( access( atpwrdown, X_OK ) != -1 )
-        {
-          sprintf( message, "execute power down script %s", atpwrdown);
-          syslog( LOG_NOTICE, "%s", message); 
-          ok = system( atpwrdown );
-          sleep( 5 );
-        }
-        pwroff = 1;
-        ok = system( "/bin/sync" );
-        ok = system( "/sbin/shutdown -h now" );
-      }
-    }
-
-    if( ( unxs >= nxtvolts || (nxtvolts - unxs) > voltint ) && pwroff == 0 )
-    {
-      nxtvolts = voltint+unxs;
-      volts = readvolts();
-      if( volttempa != 0 ) temp = readtemp();
-      if( temp > -100 && temp < 100 && volttempa != 0 ) voltcal = volttempa * temp * temp + volttempb * temp + volttempc;
-      voltsV = voltcal * ( 1023 - volts ) + vdrop;
-      if( voltsV < Vmin ) Vmin = voltsV;
-      if( voltsV > Vmax ) Vmax = voltsV;
-      Vave += voltsV;
-      Vaven++;
-      if( temp > -100 && temp < 100 ) 
-      {
-        if( temp < Tmin ) Tmin = temp;
-        if( temp > Tmax)  Tmax = temp;
-        Tave += temp;
-        Taven++;
-      }
-      cputemp = readcputemp();
-      if( cputemp > -100 ) 
-      {
-        if( cputemp < Tcpumin ) Tcpumin = cputemp;
-        if( cputemp > Tcpumax ) Tcpumax = cputemp;
-        Tcpuave += cputemp;
-        Tcpuaven++;
-      }
-
-      battlev = battlevel( voltsV );
-      if( battlev >= 95 ) 
-      {
-        if( battfull == 0 && solarpwr == 1 )
-          syslog( LOG_NOTICE, "battery full, stop cyclic power down");
-        battfull = 1;
-      }
-      if( battlev < 85 ) 
-      {
-        if( battfull == 1 && solarpwr == 1 )
-          syslog( LOG_NOTICE, "battery not full any more, restart cyclic power down");
-        battfull = 0;
-      }
-      batim = battime( battlev, battcap, pkfact, phours, current);
-      sprintf( message, "read voltage %d (%4.1f V %3.0f %% %4.0f hours)", volts, voltsV, battlev, batim);
-      if( temp > -100 && temp < 100 && volttempa != 0 ) sprintf( message, "read voltage %d (%4.1f V %3.0f %% %4.0f hours at %4.1f C)", volts, voltsV, battlev, batim, temp);
-      syslog( LOG_INFO | LOG_DAEMON, "%s", message);
-      ophours = optime( battlev, minbattlev, battcap, pkfact, phours, current);
-      write_battery( volts, voltsV, batim, ophours, battlev);
-      if(volts>minvolts)
-      {
-        syslog( LOG_WARNING, "battery voltage low %d, shut down and power off", volts);
-        sleep( 1 );
-        if( access( atpwrdown, X_OK ) != -1 )
-        {
-          sprintf( message, "execute power down script %s", atpwrdown);
-          syslog( LOG_NOTICE, "%s", message);
-          ok = system( atpwrdown );
-          sleep( 5 );
-        }
-        pwroff = 2;
-        ok = system( "/bin/sync" );
-        ok = system( "/sbin/shutdown -h now battery low" );
-      }
-      if( battlev < minbattlev )
-      {
-        sprintf( message, "battery charge low %3.0f %%, shut down and power off", battlev);
-        syslog( LOG_WARNING, "%s", message);
-        sleep( 1 );
-        if( access( atpwrdown, X_OK ) != -1 )
-        {
-          sprintf( message, "execute power down script %s", atpwrdown);
-          syslog( LOG_NOTICE, "%s", message); 
-          ok = system( atpwrdown );
-          sleep( 5 );
-        }
-        pwroff = 1;
-        ok = system( "/bin/sync" );
-        ok = system( "/sbin/shutdown -h +5 battery charge low" );
-      }
-      if( voltsV > maxbattvolts )
-      {
-        syslog( LOG_WARNING, "too high charging voltage %4.1f V reached", voltsV);
-        sleep( 1 );
-        ok = system( "/usr/bin/wall too high charging voltage reached" );
-      }
-      syslog( LOG_DEBUG, "unxs=%d nxtvolts=%d", unxs, nxtvolts);
-      if( reset_event_register() != 1 )
-        syslog( LOG_ERR | LOG_DAEMON, "failed to reset event register");
-      sleep( 1 );
-      if( reset_event_register() != 1 )
-        syslog( LOG_ERR | LOG_DAEMON, "failed to reset event register");
-      sleep( 1 );
-    }
+    sprintf( message, "could not create %s", battstatefile);
+    syslog( LOG_ERR | LOG_DAEMON, "%s", message);
+  }
+  else battv = battst->v;
 
-    if( ( unxs >= nxtbutton || (nxtbutton - unxs) > buttonint )&& pwroff == 0 )
-    {
-      button = read_button();
-      nxtbutton = buttonint + unxs;
-      if( button == 0x01 || button == 0x81 )
-      {
-        syslog( LOG_NOTICE | LOG_DAEMON, "button pressed");
-        ok = write_cmd( 0x25, 0, 0); // turn on red LED
-        sleep( 1 );
+  if( evloop_init( &ev ) != 1 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "failed to start event loop");
+    cont = 0;
+  }
 
-        if( reset_event_register() != 1 )
-          syslog( LOG_ERR | LOG_DAEMON, "failed to reset event register");
-        sleep( 1 );
+  adcsumok = testadcsum();
+  if( adcsumok == 1 ) syslog( LOG_INFO | LOG_DAEMON, "A/D conversions summed on PIC");
 
-        if( reset_event_register() != 1 )
-          syslog( LOG_ERR | LOG_DAEMON, "failed to reset event register");
-        sleep( 1 );
+  evloop_task( &ev, &task_volts, 0 );
+  evloop_task( &ev, &task_start, 15 );
+  buttondelay = buttonint;
+  buttonactive = evloop_now();
+  buttontask = evloop_task( &ev, &task_button, 20 );
+  if( buttongpio >= 0 )
+  {
+    gpiofd = button_gpio_open( buttongpio );
+    if( gpiofd >= 0 ) buttonwired = ( evloop_watch( &ev, gpiofd, &button_edge ) >= 0 );
+  }
+  ctlfd = control_watch_open();
+  if( ctlfd >= 0 ) evloop_watch( &ev, ctlfd, &control_event );
+  else syslog( LOG_NOTICE | LOG_DAEMON, "control files are polled");
+  read_controls();
+  pdowntask = evloop_task( &ev, &task_pdown, 30 );
+  sleeptask = evloop_task( &ev, &task_sleep, 60 );
+  if( countint > 10 ) evloop_task( &ev, &task_counter, 300 );
+  if( clockint > 0 ) evloop_task( &ev, &task_clock, 1 );
+  if( wifint >= 60 )
+  {
+    evloop_task( &ev, &task_wifi, wifint );
+    ifuptask = evloop_task( &ev, &task_ifup, -1 );
+  }
 
-        button = 0;
-        wtime = 0;
-        while( wtime<=confdelay &&( button==0x00 || button==0x80 ) )
-        {
-          sleep( 1 );
-          wtime++;
-          button = read_button();
-          if( button == 0x01 || button == 0x81 )
-          {
-            syslog( LOG_NOTICE, "shutdown confirmed" );
-            ok = write_cmd( 0x15, 0, 0); // turn off red LED 
-            sleep( 1 );
-            if( access( atpwrdown, X_OK ) != -1 )
-            {
-              sprintf( message, "execute power down script %s", atpwrdown);
-              syslog( LOG_NOTICE, "%s", message);
-              ok = system( atpwrdown );
-              sleep( 5 );
-            }
-            pwroff = 1;
-            ok = system( "/bin/sync" );
-            ok = system( "/sbin/shutdown -h now" );
-          }
-        }
-        sleep( 1 ); 
-        ok = write_cmd( 0x15, 0, 0); // turn off red LED
-      }
-      sprintf( message, "unxs=%d nxtbutton=%d", unxs, nxtbutton);
-      syslog( LOG_DEBUG, "%s", message);
-    }
+  statfd = i2c_stats_listen( statsock );
+  if( statfd >= 0 ) evloop_watch( &ev, statfd, &i2c_stats_serve );
+  if( clockfd >= 0 ) evloop_watch( &ev, clockfd, &clock_set );
 
-    if( ( unxs >= nxtcounter || (nxtcounter - unxs) > countint )&& pwroff == 0 && countint > 10 ) 
+  while( cont == 1 )
+  {
+    if( evloop_run( &ev ) < 0 ) cont = 0;
+    if( dumpstats == 1 )
     {
-      nxtcounter = countint + unxs;
-      timer = read_timer();
-      syslog( LOG_INFO | LOG_DAEMON, "PIC timer at %d", timer );
-      write_timer( timer );
+      dumpstats = 0;
+      i2c_stats_dump( statsfile );
     }
-
-    if(( unxs >= nxtwifi || (nxtwifi - unxs) > wifint )&& pwroff == 0 && wifint >= 60 )
+    if( hupsig == 1 )
     {
-      nxtwifi = wifint + unxs;
-      wifiup = read_wifi();
-      syslog( LOG_INFO | LOG_DAEMON, "WiFi status %d", wifiup);
-      if( wifiup == 1 ) 
-      {
-        wifiuptime += wifint;
-        wifidown = 0;
-      }
-      else if( wifiup == -1 ) wifidown += wifint;
-
-      if( wifiup == -1 && wifidown > wifitimeout )
-      {
-        if( wifiact == 1 )
-        {
-          syslog( LOG_NOTICE, "interface down" );
-          ok = system( "/sbin/ifdown wlan0" );
-          sleep( 10 );
-          syslog( LOG_NOTICE, "interface up" );
-          ok = system( "/sbin/ifup wlan0" );
-        }
-        else if( wifiact == 2 )
-        {
-          syslog( LOG_WARNING, "reboot system" );
-          ok = system( "/bin/sync" );
-          ok = system( "/sbin/shutdown -r now" );
-        }
-        else if( wifiact == 3 )
-        {
-          syslog( LOG_WARNING, "power cycle system" );
-          pwroff = 3; 
-          ok = system( "/bin/sync" );
-          ok = system( "/sbin/shutdown -h now" );
-        }
-        wifidown = 0;
-      }
+      hupsig = 0;
+      hup_powerdown();
     }
+  }
 
-    sleep( 1 );
+  evloop_close( &ev );
+  if( statfd >= 0 )
+  {
+    close( statfd );
+    unlink( statsock );
   }
+  if( gpiofd >= 0 ) close( gpiofd );
+  if( clockfd >= 0 ) close( clockfd );
+  if( ctlfd >= 0 ) close( ctlfd );
+  battstate_close( battst );
+
+  if( termsig == 1 ) powerdown_exit();
 
   int timerstop = 0;
   unxstop = time( NULL );
@@ -1740,7 +2122,7 @@ int main()
     Vave /= Vaven;
     Tave /= Taven;
     Tcpuave /= Tcpuaven;
-    writestat(statfile, unxstart, unxstop, timerstart, timerstop, Vmin, Vave, Vmax, Tmin, Tave, Tmax, Tcpumin, Tcpuave, Tcpumax, wifiuptime);
+    writestat(unxstart, unxstop, timerstart, timerstop, Vmin, Vave, Vmax, Tmin, Tave, Tmax, Tcpumin, Tcpuave, Tcpumax, wifiuptime);
   }
 
   syslog( LOG_NOTICE | LOG_DAEMON, "remove PID file" );
@@ -0,0 +1,307 @@
+/**************************************************************************
+ *
+ * Stream A/D readings from PiPIC to a binary file as fast as the software
+ * i2c of the PIC allows. Each reading is timestamped and passed through a
+ * lock-free ring buffer to a writer thread so that file writes do not
+ * delay the acquisition.
+ *
+ * Copyright (C) 2014 - 2021 Jaakko Koivuniemi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************
+ *
+ * Sat Oct 17 21:05:37 CDT 2026
+ *
+ * Jaakko Koivuniemi
+ **/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include "i2csession.h"
+#include "i2cstats.h"
+
+#define RINGSIZE 65536 // number of readings in ring buffer, power of two
+#define LOCKSAMPLES 32 // readings taken while the i2c port is kept locked
+#define WRITEBLOCK 512 // readings written to file at once
+
+const char *i2cdev = "/dev/i2c-1"; // i2c device file
+const int address = 0x26; // default PiPIC i2c address
+const int i2lockmax = 10; // maximum number of times to try lock i2c port
+
+struct sample
+{
+  uint64_t us; // time from start [us]
+  uint16_t value; // A/D reading 0-1023
+};
+
+// single producer single consumer ring, only the acquisition loop stores
+// head and only the writer thread stores tail
+struct sample ring[ RINGSIZE ];
+atomic_uint head; // next reading to store
+atomic_uint tail; // next reading to write to file
+atomic_int done; // 1=acquisition finished
+
+FILE *outf = NULL; // binary output file
+unsigned long nwritten = 0; // readings written to file
+volatile sig_atomic_t cont = 1; // acquisition loop flag
+
+void printusage()
+{
+  printf("usage: pipicscope [-a address] [-c channel] [-n N] [-t seconds] [-f file] [-b] [-r] [-h] [-v] [-V]\n");
+}
+
+void printversion()
+{
+  printf("pipicscope v. 20261017, Jaakko Koivuniemi\n");
+}
+
+void stop(int sig)
+{
+  cont = 0;
+}
+
+// monotonic time in seconds
+double now()
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// store little endian integer of n bytes
+void putle(unsigned char *buf, uint64_t v, int n)
+{
+  int i;
+
+  for( i = 0; i < n; i++ ) buf[ i ] = ( v >> ( 8 * i ) ) & 0xFF;
+}
+
+// file header: magic "PPSC", version 1, channel, i2c address, reserved
+// byte and start time as microseconds since the epoch
+int write_header(int ch, int addr)
+{
+  unsigned char hdr[ 16 ];
+  struct timespec ts;
+
+  clock_gettime( CLOCK_REALTIME, &ts );
+
+  memcpy( hdr, "PPSC", 4 );
+  hdr[ 4 ] = 1;
+  hdr[ 5 ] = ch;
+  hdr[ 6 ] = addr;
+  hdr[ 7 ] = 0;
+  putle( &hdr[ 8 ], (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000, 8 );
+
+  return ( fwrite( hdr, sizeof(hdr), 1, outf ) == 1 );
+}
+
+// writer thread spills the ring to the file, each reading is ten bytes
+// with 64-bit time and 16-bit value in little endian order
+void *writer(void *arg)
+{
+  unsigned char buf[ 10 * WRITEBLOCK ];
+  unsigned int h, t;
+  int n, fin;
+  struct timespec ts = { 0, 10000000 };
+
+  while( 1 )
+  {
+    fin = atomic_load_explicit( &done, memory_order_acquire );
+    h = atomic_load_explicit( &head, memory_order_acquire );
+    t = atomic_load_explicit( &tail, memory_order_relaxed );
+
+    if( h == t )
+    {
+      if( fin ) break;
+      nanosleep( &ts, NULL );
+      continue;
+    }
+
+    for( n = 0; t != h && n < WRITEBLOCK; n++, t++ )
+    {
+      putle( &buf[ 10 * n ], ring[ t & ( RINGSIZE - 1 ) ].us, 8 );
+      putle( &buf[ 10 * n + 8 ], ring[ t & ( RINGSIZE - 1 ) ].value, 2 );
+    }
+    atomic_store_explicit( &tail, t, memory_order_release );
+
+    if( fwrite( buf, 10, n, outf ) != (size_t)n )
+    {
+      perror( "Writing to file failed" );
+      break;
+    }
+    nwritten += n;
+  }
+
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  int verb = 0; // 1=verbosed output
+  int ch = 3; // A/D channel 0, 1 or 3
+  long nmax = 0; // number of readings, 0=until stopped
+  double tmax = 0; // acquisition time [s], 0=until stopped
+  char fileName[ 200 ] = "pipicscope.dat";
+  int addr = address;
+  int optch = 0;
+
+  unsigned char wbuf[ 1 ];
+  unsigned char rbuf[ 2 ];
+  unsigned int h;
+  long nread = 0, nerr = 0, noverrun = 0;
+  int i, ok, value = 0;
+  double t0, t1, t2, tlast = -1, treport, gap, maxgap = 0;
+  pthread_t wthread;
+
+  while( optch != -1 )
+  {
+    optch = getopt( argc, argv, "a:c:n:t:f:brhvV" );
+    if( optch == 'a' ) sscanf( optarg, "%X", &addr );
+    if( optch == 'c' ) ch = atoi( optarg );
+    if( optch == 'n' ) nmax = atol( optarg );
+    if( optch == 't' ) tmax = atof( optarg );
+    if( optch == 'f' ) strncpy( fileName, optarg, sizeof(fileName) - 1 );
+    if( optch == 'b' ) i2cses.busd = 1;
+    if( optch == 'r' ) i2cses.rdwr = 1;
+    if( optch == 'v' ) verb = 1;
+    if( optch == 'h' )
+    {
+      printusage();
+      return 0;
+    }
+    if( optch == 'V' )
+    {
+      printversion();
+      return 0;
+    }
+  }
+
+  if( addr < 0x03 || addr > 0x77 || ( ch != 0 && ch != 1 && ch != 3 ) )
+  {
+    printusage();
+    return -1;
+  }
+
+  i2cses.dev = i2cdev;
+  i2cses.addr = addr;
+  i2cses.lockmax = i2lockmax;
+  if( i2c_session_open( &i2cses ) != 1 )
+  {
+    fprintf( stderr, "Could not open i2c port\n" );
+    return -1;
+  }
+
+  outf = fopen( fileName, "wb" );
+  if( outf == NULL )
+  {
+    perror( "Could not open output file" );
+    return -1;
+  }
+  if( write_header( ch, addr ) != 1 )
+  {
+    perror( "Writing to file failed" );
+    return -1;
+  }
+
+  if( pthread_create( &wthread, NULL, &writer, NULL ) != 0 )
+  {
+    fprintf( stderr, "Could not start writer thread\n" );
+    return -1;
+  }
+
+  signal( SIGINT, &stop );
+  signal( SIGTERM, &stop );
+
+  wbuf[ 0 ] = 0x40 + ch;
+  t0 = now();
+  treport = t0 + 1;
+
+  while( cont == 1 )
+  {
+    if( i2c_session_lock( &i2cses ) != 1 )
+    {
+      fprintf( stderr, "Could not lock i2c port\n" );
+      break;
+    }
+
+    for( i = 0; i < LOCKSAMPLES && cont == 1; i++ )
+    {
+// the conversion is done between the write and the read
+      t1 = now();
+      ok = i2c_session_xfer( &i2cses, wbuf, 1, rbuf, 2 );
+      t2 = now();
+
+      value = 256 * rbuf[ 0 ] + rbuf[ 1 ];
+      if( ok != 1 || value > 1023 )
+      {
+        nerr++;
+        continue;
+      }
+
+      if( tlast >= 0 )
+      {
+        gap = t2 - tlast;
+        if( gap > maxgap ) maxgap = gap;
+      }
+      tlast = t2;
+      nread++;
+
+      h = atomic_load_explicit( &head, memory_order_relaxed );
+      if( h - atomic_load_explicit( &tail, memory_order_acquire ) >= RINGSIZE ) noverrun++;
+      else
+      {
+        ring[ h & ( RINGSIZE - 1 ) ].us = (uint64_t)( 1e6 * ( 0.5 * ( t1 + t2 ) - t0 ) );
+        ring[ h & ( RINGSIZE - 1 ) ].value = value;
+        atomic_store_explicit( &head, h + 1, memory_order_release );
+      }
+
+      if( nmax > 0 && nread >= nmax ) cont = 0;
+      if( tmax > 0 && t2 - t0 >= tmax ) cont = 0;
+    }
+
+    i2c_session_unlock( &i2cses );
+
+    if( verb == 1 && tlast >= treport )
+    {
+      printf( "%7.1f s %8ld readings %6.1f/s last %4d\n", tlast - t0, nread, nread / ( tlast - t0 ), value );
+      treport += 1;
+    }
+  }
+
+  t2 = now();
+  atomic_store_explicit( &done, 1, memory_order_release );
+  pthread_join( wthread, NULL );
+  fclose( outf );
+
+  printf( "AN%d: %ld readings in %.2f s, %.1f readings/s\n", ch, nread, t2 - t0, ( t2 > t0 ) ? nread / ( t2 - t0 ) : 0 );
+  printf( "mean interval %.2f ms, longest %.2f ms\n", ( nread > 1 ) ? 1e3 * ( t2 - t0 ) / nread : 0, 1e3 * maxgap );
+  printf( "%ld i2c errors, %ld ring overruns, %lu readings written to %s\n", nerr, noverrun, nwritten, fileName );
+  if( verb == 1 ) i2c_stats_print( stdout );
+
+  i2c_session_close( &i2cses );
+
+  return 0;
+}
@@ -0,0 +1,332 @@
+/**************************************************************************
+ *
+ * Simulate PiPIC processors for testing the PiPIC daemons without
+ * Raspberry Pi. The simulator listens the same socket as pipicbusd and
+ * answers the i2c transfers with a model of the PIC firmware.
+ *
+ * Copyright (C) 2014 - 2021 Jaakko Koivuniemi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************
+ *
+ * Sat Oct 17 14:02:11 CDT 2026
+ *
+ * Jaakko Koivuniemi
+ **/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "busproto.h"
+#include "picsim.h"
+
+#define MAXCLIENTS 16 // maximum number of connected daemons
+#define MAXADDR 128 // number of 7-bit i2c addresses
+
+struct picsim *pics[ MAXADDR ]; // simulated PIC for each address or NULL
+
+int verb = 0; // 1=verbosed output
+int bitrate = 10000; // i2c clock [Hz], 0=no delay
+double errate = 0; // probability of failed transfer
+double corrupt = 0; // probability of one flipped bit in read data
+double picycle = 0.524288; // PIC internal timer cycle [s]
+int ioc = 0x01; // interrupt on change pins, GP0 is push button
+int trisio = 0x0F; // GP4 and GP5 outputs for LED, switches and H-bridge
+int adc[ 4 ] = { 512, 512, 512, 512 }; // A/D readings
+int adcnoise = 0; // maximum random error in A/D reading
+double motor = 0; // AN0 change rate with H-bridge motor [1/s], 0=no motor
+int button = 0; // push button pin
+volatile int press = 0; // 1=push button pressed, 2=released
+
+unsigned long ntrans = 0, nerr = 0; // number of transfers and errors
+
+void printusage()
+{
+  printf("usage: pipicsim [-b bitrate] [-e errors] [-x corrupt] [-t cycle] [-i ioc] [-o trisio] [-p pin] [-0 N] [-1 N] [-3 N] [-n noise] [-m rate] [-s socket] [-h] [-v] [-V]\n");
+}
+
+void printversion()
+{
+  printf("pipicsim v. 20261017, Jaakko Koivuniemi\n");
+}
+
+// monotonic time in seconds
+double now()
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// simulated PIC at address, created with erased EEPROM on first use
+struct picsim *getpic(int addr)
+{
+  struct picsim *pic;
+  int i;
+
+  if( pics[ addr ] != NULL ) return pics[ addr ];
+
+  pic = malloc( sizeof(struct picsim) );
+  if( pic == NULL ) return NULL;
+
+  picsim_init( pic, addr, now() );
+  pic->eeprom[ 0x15 ] = trisio; // ini_TRISIO
+  pic->eeprom[ 0x17 ] = ~ioc; // ini_IOC is stored inverted
+  pic->cycle = picycle;
+  for( i = 0; i < 4; i++ ) pic->adc[ i ] = adc[ i ];
+  pic->adcnoise = adcnoise;
+  pic->motor = motor;
+  pic->mpos = adc[ 0 ];
+  picsim_setup( pic );
+  pics[ addr ] = pic;
+
+  if( verb == 1 ) printf( "PIC at 0x%02x\n", addr );
+
+  return pic;
+}
+
+// wait for the time the transfer takes on the i2c bus, each byte is 8 bits
+// and acknowledgement with start and stop bits for each message
+void busdelay(int wlength, int rlength)
+{
+  int bits = 0;
+  struct timespec ts;
+  double t;
+
+  if( bitrate <= 0 ) return;
+
+  if( wlength > 0 ) bits += 9 * ( wlength + 1 ) + 2;
+  if( rlength > 0 ) bits += 9 * ( rlength + 1 ) + 2;
+
+  t = (double)bits / bitrate;
+  ts.tv_sec = (time_t)t;
+  ts.tv_nsec = (long)( ( t - ts.tv_sec ) * 1e9 );
+  nanosleep( &ts, NULL );
+}
+
+// probability test
+int chance(double p)
+{
+  return ( p > 0 && rand() < p * RAND_MAX );
+}
+
+// serve one request
+void serve(const struct busreq *req, struct busrep *rep)
+{
+  struct picsim *pic;
+  int i;
+
+  memset( rep, 0, sizeof(struct busrep) );
+
+  if( req->flags & BUS_RELEASE )
+  {
+    rep->status = 1;
+    return;
+  }
+
+  if( req->addr > 0x77 || req->wlength > BUSMAXDATA || req->rlength > BUSMAXDATA )
+  {
+    rep->status = -4;
+    return;
+  }
+
+  ntrans++;
+  busdelay( req->wlength, req->rlength );
+
+  pic = getpic( req->addr );
+  if( pic == NULL || chance( errate ) )
+  {
+    nerr++;
+    rep->status = -4;
+    if( verb == 1 ) printf( "0x%02x no acknowledgement\n", req->addr );
+    return;
+  }
+
+  picsim_update( pic, now() );
+  if( req->wlength > 0 ) picsim_write( pic, req->wbuf, req->wlength );
+  if( req->rlength > 0 )
+  {
+    picsim_read( pic, rep->rbuf, req->rlength );
+    if( chance( corrupt ) ) rep->rbuf[ rand() % req->rlength ] ^= 1 << ( rand() % 8 );
+  }
+  rep->status = 1;
+  rep->rlength = req->rlength;
+
+  if( verb == 1 )
+  {
+    printf( "0x%02x", req->addr );
+    if( req->wlength > 0 ) printf( " send" );
+    for( i = 0; i < req->wlength; i++ ) printf( " %02x", req->wbuf[ i ] );
+    if( req->rlength > 0 ) printf( " receive" );
+    for( i = 0; i < req->rlength; i++ ) printf( " %02x", rep->rbuf[ i ] );
+    printf( "\n" );
+  }
+}
+
+int cont = 1; /* main loop flag */
+
+void stop(int sig)
+{
+  cont = 0;
+}
+
+// SIGUSR1 press and SIGUSR2 release push button on all PICs
+void buttonsig(int sig)
+{
+  press = ( sig == SIGUSR1 ) ? 1 : 2;
+}
+
+int main(int argc, char **argv)
+{
+  int c, n, a, fd;
+  int nfds;
+  char sockname[ 108 ] = BUSSOCKET;
+  struct pollfd fds[ MAXCLIENTS + 1 ];
+  struct busreq req;
+  struct busrep rep;
+  struct sockaddr_un serv_addr;
+  int sockfd;
+
+  int optch = 0;
+  while( optch != -1 )
+  {
+    optch = getopt( argc, argv, "b:e:x:t:i:o:p:0:1:3:n:m:s:hvV" );
+    if( optch == 'b' ) bitrate = atoi( optarg );
+    if( optch == 'e' ) errate = atof( optarg );
+    if( optch == 'x' ) corrupt = atof( optarg );
+    if( optch == 't' ) picycle = atof( optarg );
+    if( optch == 'i' ) sscanf( optarg, "%X", &ioc );
+    if( optch == 'o' ) sscanf( optarg, "%X", &trisio );
+    if( optch == 'p' ) button = atoi( optarg );
+    if( optch == '0' ) adc[ 0 ] = atoi( optarg );
+    if( optch == '1' ) adc[ 1 ] = atoi( optarg );
+    if( optch == '3' ) adc[ 3 ] = atoi( optarg );
+    if( optch == 'n' ) adcnoise = atoi( optarg );
+    if( optch == 'm' ) motor = atof( optarg );
+    if( optch == 's' ) strncpy( sockname, optarg, sizeof(sockname) - 1 );
+    if( optch == 'v' ) verb = 1;
+    if( optch == 'h' )
+    {
+      printusage();
+      return 0;
+    }
+    if( optch == 'V' )
+    {
+      printversion();
+      return 0;
+    }
+  }
+
+  signal( SIGINT, &stop );
+  signal( SIGTERM, &stop );
+  signal( SIGUSR1, &buttonsig );
+  signal( SIGUSR2, &buttonsig );
+  srand( (unsigned int)time( NULL ) );
+
+  sockfd = socket( AF_UNIX, SOCK_SEQPACKET, 0 );
+  if( sockfd < 0 )
+  {
+    perror( "Could not open socket" );
+    return -1;
+  }
+
+  memset( &serv_addr, 0, sizeof(serv_addr) );
+  serv_addr.sun_family = AF_UNIX;
+  strncpy( serv_addr.sun_path, sockname, sizeof(serv_addr.sun_path) - 1 );
+  unlink( sockname );
+
+  if( bind( sockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr) ) < 0 )
+  {
+    perror( "Could not bind socket" );
+    return -1;
+  }
+  listen( sockfd, MAXCLIENTS );
+  if( verb == 1 ) printf( "Listen %s\n", sockname );
+
+  fds[ 0 ].fd = sockfd;
+  fds[ 0 ].events = POLLIN;
+  nfds = 1;
+
+  while( cont == 1 )
+  {
+    if( press != 0 )
+    {
+      for( a = 0; a < MAXADDR; a++ )
+      {
+        if( pics[ a ] != NULL ) picsim_pin( pics[ a ], button, press == 2 );
+      }
+      if( verb == 1 ) printf( "button %s\n", ( press == 1 ) ? "pressed" : "released" );
+      press = 0;
+    }
+
+    n = poll( fds, nfds, -1 );
+    if( n < 0 )
+    {
+      if( errno == EINTR ) continue;
+      perror( "Socket poll failed" );
+      break;
+    }
+
+    for( c = 1; c < nfds; c++ )
+    {
+      if( fds[ c ].revents == 0 ) continue;
+
+      if( recv( fds[ c ].fd, &req, sizeof(req), 0 ) != sizeof(req) )
+      {
+        close( fds[ c ].fd );
+        fds[ c ] = fds[ nfds - 1 ];
+        nfds--;
+        c--;
+        continue;
+      }
+
+      serve( &req, &rep );
+      send( fds[ c ].fd, &rep, sizeof(rep), MSG_NOSIGNAL );
+    }
+
+    if( fds[ 0 ].revents & POLLIN )
+    {
+      fd = accept( sockfd, NULL, NULL );
+      if( fd >= 0 && nfds <= MAXCLIENTS )
+      {
+        fds[ nfds ].fd = fd;
+        fds[ nfds ].events = POLLIN;
+        fds[ nfds ].revents = 0;
+        nfds++;
+      }
+      else if( fd >= 0 ) close( fd );
+    }
+  }
+
+  for( c = 1; c < nfds; c++ ) close( fds[ c ].fd );
+  close( sockfd );
+  unlink( sockname );
+
+  printf( "transfers %lu errors %lu\n", ntrans, nerr );
+
+  return 0;
+}
@@ -0,0 +1,149 @@
+/**************************************************************************
+ *
+ * Print the power up statistics log written by pipicpowerd as text in
+ * the format of the old pipicpowers.log, or the daily uptime sums.
+ *
+ * Copyright (C) 2014 - 2021 Jaakko Koivuniemi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************
+ *
+ * Sat Oct 17 23:20:14 CDT 2026
+ *
+ * Jaakko Koivuniemi
+ **/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+#include "statlog.h"
+#include "battstate.h"
+
+void printusage()
+{
+  printf("usage: pipicstat [-f file] [-d] [-r] [-b] [-h] [-V]\n");
+}
+
+void printversion()
+{
+  printf("pipicstat v. 20261017, Jaakko Koivuniemi\n");
+}
+
+int main(int argc, char **argv)
+{
+  char logfile[ 200 ] = "/var/log/pipicpowers.dat";
+  char dayfile[ 210 ] = "";
+  int days = 0; // 1=print daily sums
+  int reindex = 0; // 1=write day file again
+  int batt = 0; // 1=print battery state
+  int optch = 0;
+  struct statrec r;
+  struct statday d;
+  struct battstate *bs;
+  struct battvalues v;
+  time_t t;
+  char tstr[ 25 ];
+  FILE *f;
+
+  while( optch != -1 )
+  {
+    optch = getopt( argc, argv, "f:drbhV" );
+    if( optch == 'f' ) strncpy( logfile, optarg, sizeof(logfile) - 1 );
+    if( optch == 'd' ) days = 1;
+    if( optch == 'r' ) reindex = 1;
+    if( optch == 'b' ) batt = 1;
+    if( optch == 'h' )
+    {
+      printusage();
+      return 0;
+    }
+    if( optch == 'V' )
+    {
+      printversion();
+      return 0;
+    }
+  }
+
+  if( batt == 1 )
+  {
+    bs = battstate_open( "/run/pipicpowerd.battery" );
+    if( bs == NULL || battstate_read( bs, &v ) != 1 )
+    {
+      fprintf( stderr, "Could not read battery state\n" );
+      return -1;
+    }
+    battstate_close( bs );
+    t = v.time;
+    strftime( tstr, 25, "%Y-%m-%d %H:%M:%S", localtime( &t ) );
+    printf( "%s battery %d %4.1f V %3.0f %% %4.1f h left %4.1f h to empty", tstr, v.battery, v.volts, v.battlevel, v.ophours, v.hoursleft );
+    if( v.temp > -100 ) printf( " at %4.1f C", v.temp );
+    if( v.cputemp > -100 ) printf( " CPU %4.1f C", v.cputemp );
+    printf( "\n" );
+    if( v.timertime > 0 )
+    {
+      t = v.timertime;
+      strftime( tstr, 25, "%Y-%m-%d %H:%M:%S", localtime( &t ) );
+      printf( "%s PIC timer %d\n", tstr, v.timer );
+    }
+    return 0;
+  }
+
+// day file has the same name with extension .days
+  strncpy( dayfile, logfile, sizeof(dayfile) - 6 );
+  if( strlen( dayfile ) > 4 && strcmp( &dayfile[ strlen( dayfile ) - 4 ], ".dat" ) == 0 ) dayfile[ strlen( dayfile ) - 4 ] = 0;
+  strcat( dayfile, ".days" );
+
+  if( reindex == 1 )
+  {
+    if( statlog_reindex( logfile, dayfile ) != 1 )
+    {
+      fprintf( stderr, "Could not write %s\n", dayfile );
+      return -1;
+    }
+    return 0;
+  }
+
+  if( days == 1 )
+  {
+    f = fopen( dayfile, "rb" );
+    if( f == NULL )
+    {
+      perror( "Could not open day file" );
+      return -1;
+    }
+    printf( "day        uptime [s] power ups\n" );
+    while( statlog_readday( f, &d ) == 1 )
+    {
+      t = 86400 * (time_t)d.day;
+      strftime( tstr, 25, "%Y-%m-%d", gmtime( &t ) );
+      printf( "%s %10u %9u\n", tstr, d.uptime, d.nrec );
+    }
+    fclose( f );
+    return 0;
+  }
+
+  f = fopen( logfile, "rb" );
+  if( f == NULL )
+  {
+    perror( "Could not open statistics log" );
+    return -1;
+  }
+  while( statlog_read( f, &r ) == 1 ) statlog_text( stdout, &r );
+  fclose( f );
+
+  return 0;
+}
@@ -48,14 +48,29 @@
 #include "writecmd.h"
 #include "readdata.h"
 #include "testi2c.h"
+#include "transact.h"
+#include "i2csession.h"
+#include "i2cstats.h"
+#include "cmdbatch.h"
+#include "evloop.h"
+#include "picclock.h"
 
 #define CHECK_BIT(var,pos) !!((var) & (1<<(pos)))
+#define CMDQMAX 256 // maximum number of queued client commands
+#define CMDRUNMAX 32 // maximum number of commands run in one round
+#define CLIENTMAX 32 // maximum number of client connections
+#define CLIENTLINE 256 // longest command line from client
+#define CLIENTOUT 4096 // reply bytes waiting for a slow client
+#define CLIENTIDLE 0.2 // text without newline is a command after this idle time [s]
+#define CLIENTRETRY 0.05 // interval to retry sending to a slow client [s]
 
 const int version = 20150221; // program version
 
 int portno = 5001; // socket port number
 
 float picycle = 0.445; // length of PIC counter cycles [s]
+int clockint = 600; // PIC counter reading interval for cycle estimate [s], 0=fixed
+struct picclock pclock; // PIC counter cycle estimate
 
 const char *i2cdev = "/dev/i2c-1"; // i2c device file
 const int  address = 0x27;
@@ -65,17 +80,63 @@ int forcereset = 0; // force PIC timer reset if i2c test fails
 const char confile[ 200 ] = "/etc/pipicswd_config";
 
 const char pidfile[ 200 ] = "/run/pipicswd.pid";
+const char cyclefile[ 200 ] = "/var/lib/pipicswd/picycle"; // PIC cycle estimate
+const char statsfile[ 200 ] = "/run/pipicswd.i2cstats"; // written on SIGUSR1
+const char statsock[ 200 ] = "/run/pipicswd-i2c.sock"; // i2c statistics socket
 
 int loglev = 5;
 char message[ 200 ] = "";
 
 char status[ 200 ] = ""; // switch status message
+float statusint = 60; // switch status cache refresh interval [s], 0=no cache
+
+struct swstatus
+{
+  int ok; // 1=status read successfully
+  int gpio; // GPIO register
+  int active[ 2 ]; // 1=timed task 1 or 2 active
+  double wtime[ 2 ]; // time left for timed task [s]
+  int cmd[ 2 ]; // timed task command
+  double time; // monotonic time of reading [s]
+  double valid; // cached status valid until this time [s]
+};
+struct swstatus sws; // cached switch status
+int bulkread = 0; // 1=timed tasks read with one transfer using command 0x07
 
 int initswitch1 = 0; // switch 1 at start 0=do nothing, 1=switch on, 2=off
 int initswitch2 = 0; // switch 2 at start 0=do nothing, 1=switch on, 2=off
 int stopswitch1 = 0; // switch 1 at stop 0=do nothing, 1=switch on, 2=off
 int stopswitch2 = 0; // switch 2 at stop 0=do nothing, 1=switch on, 2=off
 
+struct swcmd
+{
+  int fd; // client socket, -1=client has gone
+  int nl; // 1=command ended with newline, the reply gets one too
+  char cmd[ 25 ]; // command from client
+};
+
+struct swclient
+{
+  int fd; // client socket, -1=free slot
+  int eof; // 1=client has closed its end, close after replies
+  int len; // bytes in line
+  char line[ CLIENTLINE ]; // command text not yet ended with newline
+  double last; // time of last data from client [s]
+  int outlen; // bytes in out
+  char out[ CLIENTOUT ]; // reply text not yet sent
+};
+
+struct evloop ev; // event loop serving the clients
+struct swclient clients[ CLIENTMAX ]; // client connections
+int linetask = -1; // task taking idle text without newline as command
+int outtask = -1; // task sending replies to slow clients
+int sockfd = -1; // listening socket
+int statfd = -1; // i2c statistics socket
+int cmdtask = -1; // task running the queued commands
+int statustask = -1; // task refreshing the switch status cache
+struct swcmd cmdq[ CMDQMAX ]; // client commands waiting for i2c
+int cmdqfirst = 0; // first command in queue
+int cmdqn = 0; // number of commands in queue
 
 // read configuration file if it exists
 void read_config()
@@ -133,12 +194,34 @@ void read_config()
              sprintf( message, "Switch 2 stop value set to %d", (int)value );
              syslog( LOG_INFO | LOG_DAEMON, "%s", message );
           }
+          if( strncmp( par, "STATUSINT", 9 ) == 0 )
+          {
+             statusint = value;
+             sprintf( message, "Switch status refresh interval %4.1f s", value );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+          }
+          if( strncmp( par, "CLOCKINT", 8 ) == 0 )
+          {
+             clockint = (int)value;
+             sprintf( message, "PIC cycle estimate counter reading interval %d s", (int)value );
+             syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+          }
           if( strncmp( par, "PICYCLE", 7 ) == 0 )
           {
              picycle = value;
              sprintf( message, "PIC cycle %f s", value );
              syslog( LOG_INFO | LOG_DAEMON, "%s", message );
           }
+          if( strncmp( par, "I2CRDWR", 7 ) == 0 )
+          {
+             i2cses.rdwr = (int)value;
+             if( i2cses.rdwr == 1 ) syslog( LOG_INFO | LOG_DAEMON, "Combined i2c command and reply with repeated start" );
+          }
+          if( strncmp( par, "I2CBUSD", 7 ) == 0 )
+          {
+             i2cses.busd = (int)value;
+             if( i2cses.busd == 1 ) syslog( LOG_INFO | LOG_DAEMON, "i2c transfers through pipicbusd" );
+          }
           if( strncmp( par, "FORCERESET", 10 ) == 0 )
           {
              if( value == 1 )
@@ -170,10 +253,10 @@ int timer1status()
   int timeron = 0;
   int gpio = 0;
 
-  ok = write_cmd( 0x01, 0x27, 1 ); 
-  if( ok == 1 )
+  gpio = transact( 0x01, 0x27, 1, 1 ); 
+  if( gpio >= 0 )
   {
-    gpio = read_data( 1 );
+    ok = 1;
     if( CHECK_BIT( gpio, 7 ) == 1 ) timeron = 1;
   }
 
@@ -187,10 +270,10 @@ int timer2status()
   int timeron = 0;
   int gpio = 0;
 
-  ok = write_cmd( 0x01, 0x30, 1 ); 
-  if( ok == 1 )
+  gpio = transact( 0x01, 0x30, 1, 1 ); 
+  if( gpio >= 0 )
   {
-    gpio = read_data( 1 );
+    ok = 1;
     if( CHECK_BIT( gpio, 7 ) == 1 ) timeron = 1;
   }
 
@@ -202,18 +285,21 @@ int timer1delay()
 {
   int ok = 0;
   int delay = 0;
-  ok = write_cmd( 0x01, 0x2D, 1 );
-  if( ok == 1 )
+  int rd = 0;
+
+  rd = transact( 0x01, 0x2D, 1, 1 );
+  if( rd >= 0 )
   {
-    delay += read_data( 1 ) * 65536;
-    ok = write_cmd( 0x01, 0x2E, 1 );
-    if( ok == 1 )
+    delay += rd * 65536;
+    rd = transact( 0x01, 0x2E, 1, 1 );
+    if( rd >= 0 )
     {
-      delay += read_data( 1 ) * 256;
-      ok = write_cmd( 0x01, 0x2F, 1 );
-      if( ok == 1 )
+      delay += rd * 256;
+      rd = transact( 0x01, 0x2F, 1, 1 );
+      if( rd >= 0 )
       {
-        delay += read_data( 1 );
+        delay += rd;
+        ok = 1;
       }
     }
   }
@@ -225,19 +311,21 @@ int timer2delay()
 {
   int ok = 0;
   int delay = 0;
+  int rd = 0;
 
-  ok = write_cmd( 0x01, 0x36, 1 );
-  if( ok == 1 )
+  rd = transact( 0x01, 0x36, 1, 1 );
+  if( rd >= 0 )
   {
-    delay += read_data( 1 ) * 65536;
-    ok = write_cmd( 0x01, 0x37, 1 );
-    if( ok == 1 )
+    delay += rd * 65536;
+    rd = transact( 0x01, 0x37, 1, 1 );
+    if( rd >= 0 )
     {
-      delay += read_data( 1 ) * 256;
-      ok = write_cmd( 0x01, 0x38, 1 );
-      if( ok == 1 )
+      delay += rd * 256;
+      rd = transact( 0x01, 0x38, 1, 1 );
+      if( rd >= 0 )
       {
-        delay += read_data( 1 );
+        delay += rd;
+        ok = 1;
       }
     }
   }
@@ -248,14 +336,10 @@ int timer2delay()
 // read timer 1 command
 int timer1cmd()
 {
-  int ok = 0;
   int cmd = 0;
 
-  ok = write_cmd( 0x01, 0x2B, 1 );
-  if( ok == 1 )
-  {
-    cmd = read_data( 1 );
-  }
+  cmd = transact( 0x01, 0x2B, 1, 1 );
+  if( cmd < 0 ) cmd = 0;
 
   return cmd;
 }
@@ -263,13 +347,10 @@ int timer1cmd()
 // read timer 2 command
 int timer2cmd()
 {
-  int ok = 0;
   int cmd = 0;
-  ok = write_cmd( 0x01, 0x34, 1 );
-  if( ok == 1 )
-  {
-    cmd = read_data( 1 );
-  }
+
+  cmd = transact( 0x01, 0x34, 1, 1 );
+  if( cmd < 0 ) cmd = 0;
 
   return cmd;
 }
@@ -296,71 +377,128 @@ int timer2cancel()
   return ok;
 }
 
-// read switch status
+// timed task command as text
+void task_text(char *text, int task, int cmd, int wtime)
+{
+  if( cmd == 0x24 ) sprintf( text, "close switch 1 after %d s", wtime ); 
+  else if( cmd == 0x14 ) sprintf( text, "open switch 1 after %d s", wtime ); 
+  else if( cmd == 0x25 ) sprintf( text, "close switch 2 after %d s", wtime );
+  else if( cmd == 0x15 ) sprintf( text, "open switch 2 after %d s", wtime ); 
+  else if( task == 1 ) sprintf( text, "other command on timer 1 after %d s", wtime ); 
+  else sprintf( text, "other command on timer2 after %d s", wtime ); 
+}
+
+// switch status text from the last status reading, the timed task delays
+// are counted down from the time of reading
+void status_text(char *text, int size)
+{
+  int i, wtime;
+  char tstr[ 50 ];
+  double age = evloop_now() - sws.time;
+
+  if( sws.ok != 1 )
+  {
+    snprintf( text, size, "status unknown" );
+    return;
+  }
+
+  snprintf( text, size, "1 %s 2 %s", CHECK_BIT( sws.gpio, 4 ) ? "closed" : "open", CHECK_BIT( sws.gpio, 5 ) ? "closed" : "open" );
+
+  for( i = 0; i < 2; i++ )
+  {
+    if( sws.active[ i ] != 1 ) continue;
+    wtime = (int)( sws.wtime[ i ] - age );
+    if( wtime < 0 ) wtime = 0;
+    task_text( tstr, i + 1, sws.cmd[ i ], wtime );
+    strncat( text, ", ", size - strlen( text ) - 1 );
+    strncat( text, tstr, size - strlen( text ) - 1 );
+  }
+}
+
+// read timed task1 and task2 blocks 0x27 - 0x38 in one transfer, the PIC
+// sends the transfer from interrupt service and changes the down counters
+// only with interrupts disabled, so each counter is read whole
+// return: 1=ok, otherwise error from transact_block()
+int read_tasks()
+{
+  int ok = 0;
+  int i;
+  unsigned char blk[ 18 ];
+  const unsigned char *t;
+
+  ok = transact_block( 0x07, 0x27, 1, blk, 18 );
+  if( ok != 1 ) return ok;
+
+  for( i = 0; i < 2; i++ )
+  {
+    t = &blk[ 9 * i ];
+    sws.active[ i ] = CHECK_BIT( t[ 0 ], 7 );
+    sws.wtime[ i ] = picycle * ( t[ 6 ] * 65536 + t[ 7 ] * 256 + t[ 8 ] );
+    sws.cmd[ i ] = t[ 4 ];
+  }
+
+  return ok;
+}
+
+// read switch status to cache, the cache is valid for 'statusint' seconds
+// or until the first timed task is due and a new reading is scheduled
+// at that time
 int read_status()
 {
   int ok = -1;
   int gpio = 0;
-  int wtime = 0;
-  int cmd = 0;
-  const char space[] = ", ";
+  int i;
+  double valid = statusint;
 
-  ok = write_cmd( 0x01, 0x05, 1 ); 
-  if( ok == 1 )
+  gpio = transact( 0x01, 0x05, 1, 1 ); 
+  if( gpio >= 0 )
   { 
-    gpio = read_data( 1 );
-    if( CHECK_BIT( gpio, 4 ) == 1 ) 
-    {
-      strcpy( message, "switch 1 closed" );
-      strcpy( status, "1 closed" ); 
-    }
-    else 
-    {
-      strcpy( message, "switch 1 open" );
-      strcpy( status, "1 open" );
-    }
+    ok = 1;
+    if( CHECK_BIT( gpio, 4 ) == 1 ) strcpy( message, "switch 1 closed" );
+    else strcpy( message, "switch 1 open" );
+    if( CHECK_BIT( gpio, 5 ) == 1 ) strcat( message, " switch 2 closed" );
+    else strcat( message, " switch 2 open" );
+    syslog( LOG_INFO | LOG_DAEMON, "%s", message );
+  }
+  else syslog( LOG_ERR | LOG_DAEMON, "failed to read PIC GPIO register" ); 
+
+  sws.ok = ok;
+  sws.gpio = gpio;
+  sws.time = evloop_now();
 
-    if( CHECK_BIT( gpio, 5 ) == 1 ) 
+  if( bulkread != 1 || read_tasks() != 1 )
+  {
+    sws.active[ 0 ] = timer1status();
+    if( sws.active[ 0 ] == 1 )
     {
-      strcat( message, " switch 2 closed" );
-      strcat( status, " 2 closed" );
+      sws.wtime[ 0 ] = picycle * timer1delay();
+      sws.cmd[ 0 ] = timer1cmd(); 
     }
-    else 
+
+    sws.active[ 1 ] = timer2status();
+    if( sws.active[ 1 ] == 1 )
     {
-      strcat( message, " switch 2 open" );
-      strcat( status, " 2 open" );
+      sws.wtime[ 1 ] = picycle * timer2delay();
+      sws.cmd[ 1 ] = timer2cmd(); 
     }
-    syslog( LOG_INFO | LOG_DAEMON, "%s", message );
   }
-  else syslog( LOG_ERR | LOG_DAEMON, "failed to read PIC GPIO register" ); 
 
-  if( timer1status() == 1 )
+  for( i = 0; i < 2; i++ )
   {
-    wtime = picycle * timer1delay();
-    cmd = timer1cmd(); 
-    if( cmd == 0x24 ) sprintf( message, "close switch 1 after %d s", wtime ); 
-    else if( cmd == 0x14 ) sprintf( message, "open switch 1 after %d s", wtime ); 
-    else if( cmd == 0x25 ) sprintf( message, "close switch 2 after %d s", wtime );
-    else if( cmd == 0x15 ) sprintf( message, "open switch 2 after %d s", wtime ); 
-    else sprintf( message, "other command on timer 1 after %d s", wtime ); 
+    if( sws.active[ i ] != 1 ) continue;
+    task_text( message, i + 1, sws.cmd[ i ], (int)sws.wtime[ i ] );
     syslog( LOG_INFO | LOG_DAEMON, "%s", message );
-    strncat( status, space, 2 );
-    strncat( status, message, 42 );
+    if( sws.wtime[ i ] + picycle < valid ) valid = sws.wtime[ i ] + picycle;
   }
 
-  if( timer2status() == 1 )
+  status_text( status, sizeof(status) );
+
+  if( statusint > 0 && ok == 1 )
   {
-    wtime = picycle * timer2delay();
-    cmd = timer2cmd(); 
-    if( cmd == 0x24 ) sprintf( message, "close switch 1 after %d s", wtime ); 
-    else if( cmd == 0x14 ) sprintf( message, "open switch 1 after %d s", wtime ); 
-    else if( cmd == 0x25 ) sprintf( message, "close switch 2 after %d s", wtime );
-    else if( cmd == 0x15 ) sprintf( message, "open switch 2 after %d s", wtime ); 
-    else sprintf( message, "other command on timer2 after %d s", wtime ); 
-    syslog( LOG_INFO | LOG_DAEMON, "%s", message );
-    strncat( status, space, 2 );
-    strncat( status, message, 42 );
+    sws.valid = sws.time + valid;
+    evloop_schedule( &ev, statustask, valid );
   }
+  else sws.valid = 0;
 
   return ok;
 }
@@ -371,6 +509,9 @@ int newtask(int sw, int operation, int delay)
 {
   int ok = 0;
   int cmd = 0x0000;
+  struct cmdbatch batch;
+
+  cmdbatch_init( &batch );
 
   if( sw == 1 && operation == 1 ) cmd = 0x2400;
   else if( sw == 1 && operation == 2 ) cmd = 0x1400; 
@@ -382,20 +523,22 @@ int newtask(int sw, int operation, int delay)
     sprintf( message, "task1 delay %d and command 0x%04x", delay, cmd );
     syslog( LOG_NOTICE | LOG_DAEMON, "%s", message );
 // timed task1
-    ok = write_cmd( 0x62, delay, 4 );
-    ok = write_cmd( 0x63, cmd, 2 );
-    ok = write_cmd( 0x64, 0, 1 );
-    ok = write_cmd( 0x61, 0, 0); // start task1
+    cmdbatch_add( &batch, 0x62, delay, 4 );
+    cmdbatch_add( &batch, 0x63, cmd, 2 );
+    cmdbatch_add( &batch, 0x64, 0, 1 );
+    cmdbatch_add( &batch, 0x61, 0, 0); // start task1
+    ok = cmdbatch_flush( &batch );
   }
   else if( timer2status() == 0 )
   {
     sprintf( message, "task2 delay %d and command 0x%04x", delay, cmd );
     syslog( LOG_NOTICE | LOG_DAEMON, "%s", message );
 // timed task2
-    ok = write_cmd( 0x72, delay, 4 );
-    ok = write_cmd( 0x73, cmd, 2 );
-    ok = write_cmd( 0x74, 0, 1 );
-    ok = write_cmd( 0x71, 0, 0 ); // start task2
+    cmdbatch_add( &batch, 0x72, delay, 4 );
+    cmdbatch_add( &batch, 0x73, cmd, 2 );
+    cmdbatch_add( &batch, 0x74, 0, 1 );
+    cmdbatch_add( &batch, 0x71, 0, 0 ); // start task2
+    ok = cmdbatch_flush( &batch );
   }
   else syslog( LOG_NOTICE | LOG_DAEMON, "tasks 1 and 2 already in use, cancel one of them first" );
 
@@ -498,10 +641,412 @@ int resetimer()
   int ok = -1;
 
   ok = write_cmd( 0x50, 0, 0 );
+  picclock_reset( &pclock );
 
   return ok;
 }
 
+// read PIC counter to follow the cycle length
+double task_clock()
+{
+  int timer;
+  double t;
+
+  t = evloop_now();
+  timer = transact( 0x51, 0, 0, 4 );
+  if( picclock_sample( &pclock, timer, 0.5 * ( t + evloop_now() ) ) == 1 ) picycle = pclock.cycle;
+
+  return clockint;
+}
+
+// run one client command
+// return: 1=command can change switch status, 0=status query only
+int run_cmd(const char *rbuff)
+{
+  int hh = 0,mm = 0,wtime = 0;
+
+  if( strncmp( rbuff, "open 1", 6 ) == 0 )
+  {
+    if( sscanf( rbuff, "open 1 %d:%d", &hh, &mm ) != EOF )
+    {
+      wtime = calcwtime( hh, mm );
+      operate_switch1( 2, wtime );
+    }
+    else operate_switch1( 2, 0 ); 
+  } 
+  else if( strncmp( rbuff, "close 1", 7 ) == 0 )
+  {
+    if( sscanf( rbuff, "close 1 %d:%d", &hh, &mm ) != EOF )
+    {
+      wtime = calcwtime( hh, mm );
+      operate_switch1( 1 ,wtime );
+    }
+    else operate_switch1( 1, 0 );
+  } 
+  else if( strncmp( rbuff, "open 2", 6 ) == 0 )
+  {
+    if( sscanf( rbuff, "open 2 %d:%d", &hh, &mm ) != EOF )
+    {
+      wtime = calcwtime( hh, mm );
+      operate_switch2( 2, wtime );
+    }
+    else operate_switch2( 2, 0 );
+  } 
+  else if( strncmp( rbuff, "close 2", 7 ) == 0 )
+  {
+    if( sscanf( rbuff, "close 2 %d:%d", &hh, &mm ) != EOF )
+    {
+      wtime = calcwtime( hh, mm );
+      operate_switch2( 1, wtime );
+    }
+    else operate_switch2( 1, 0 );
+  } 
+  else if( strncmp( rbuff, "cancel 1", 8 ) == 0 ) timer1cancel();
+  else if( strncmp( rbuff, "cancel 2", 8) == 0 ) timer2cancel();
+  else return 0;
+
+  return 1;
+}
+
+// cached status is valid when it has been read successfully, it is not
+// too old and no timed task has been due since
+int status_valid()
+{
+  return ( statusint > 0 && sws.ok == 1 && evloop_now() < sws.valid );
+}
+
+// refresh switch status cache
+double task_status()
+{
+  read_status();
+
+  return -1;
+}
+
+// find client by socket
+struct swclient *client_find(int fd)
+{
+  int i;
+
+  for( i = 0; i < CLIENTMAX; i++ ) if( clients[ i ].fd == fd ) return &clients[ i ];
+
+  return NULL;
+}
+
+// send what the client takes without waiting
+// return: 1=all sent, 0=some left, -1=failed
+int client_flush(struct swclient *cl)
+{
+  int n;
+
+  while( cl->outlen > 0 )
+  {
+    n = send( cl->fd, cl->out, cl->outlen, MSG_DONTWAIT | MSG_NOSIGNAL );
+    if( n < 0 )
+    {
+      if( errno == EAGAIN || errno == EWOULDBLOCK ) return 0;
+      if( errno == EINTR ) continue;
+      syslog( LOG_ERR | LOG_DAEMON, "Socket writing failed" );
+      return -1;
+    }
+    memmove( cl->out, &cl->out[ n ], cl->outlen - n );
+    cl->outlen -= n;
+  }
+
+  return 1;
+}
+
+void client_close(int fd);
+
+// queue reply to client, the part a slow client does not take at once is
+// sent later from the retry task
+void client_send(int fd, const char *text)
+{
+  struct swclient *cl = client_find( fd );
+  int n = strlen( text );
+  int ok;
+
+  if( cl == NULL ) return;
+
+  if( cl->outlen + n > CLIENTOUT )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Client does not read replies, close" );
+    client_close( fd );
+    return;
+  }
+  memcpy( &cl->out[ cl->outlen ], text, n );
+  cl->outlen += n;
+
+  ok = client_flush( cl );
+  if( ok < 0 ) client_close( fd );
+  else if( ok == 0 ) evloop_schedule( &ev, outtask, CLIENTRETRY );
+}
+
+// send switch status to client
+void send_status(int fd, int nl)
+{
+  char sbuff[ 210 ];
+
+  status_text( status, sizeof(status) );
+  snprintf( sbuff, sizeof(sbuff), "%s%s", status, nl ? "\n" : "" );
+
+  client_send( fd, sbuff );
+  syslog( LOG_DEBUG, "Send: %s", status );
+}
+
+// number of queued commands from client
+int client_queued(int fd)
+{
+  int i, n = 0;
+
+  for( i = 0; i < cmdqn; i++ ) if( cmdq[ ( cmdqfirst + i ) % CMDQMAX ].fd == fd ) n++;
+
+  return n;
+}
+
+// close client that has closed its end when its replies are sent
+void client_done(int fd)
+{
+  struct swclient *cl = client_find( fd );
+
+  if( cl != NULL && cl->eof == 1 && cl->outlen == 0 && client_queued( fd ) == 0 ) client_close( fd );
+}
+
+// run queued commands in arrival order and reply each with the switch
+// status, the status is read again only after a command that can change
+// it, when the cache is not valid or for command 'fresh'
+double task_cmd()
+{
+  int i;
+  int stale = 1;
+  struct swcmd *c;
+
+  if( status_valid() ) stale = 0;
+
+  for( i = 0; i < CMDRUNMAX && cmdqn > 0; i++ )
+  {
+    c = &cmdq[ cmdqfirst ];
+    cmdqfirst = ( cmdqfirst + 1 ) % CMDQMAX;
+    cmdqn--;
+
+    if( c->fd < 0 ) continue;
+
+    if( run_cmd( c->cmd ) == 1 ) stale = 1;
+    if( strncmp( c->cmd, "fresh", 5 ) == 0 ) stale = 1;
+    if( stale == 1 )
+    {
+      read_status();
+      stale = 0;
+    }
+    send_status( c->fd, c->nl );
+    client_done( c->fd );
+  }
+
+  if( cmdqn > 0 ) return 0;
+
+  return -1;
+}
+
+// queue client command for the i2c task
+void queue_cmd(int fd, const char *cmd, int nl)
+{
+  struct swcmd *c;
+
+  if( cmdqn >= CMDQMAX )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Command queue full, drop '%s'", cmd );
+    client_send( fd, nl ? "error: busy\n" : "error: busy" );
+    client_done( fd );
+    return;
+  }
+
+  if( cmdqn == 0 && status_valid() && strncmp( cmd, "status", 6 ) == 0 )
+  {
+    send_status( fd, nl ); // answer from cache without i2c
+    return;
+  }
+
+  c = &cmdq[ ( cmdqfirst + cmdqn ) % CMDQMAX ];
+  c->fd = fd;
+  c->nl = nl;
+  snprintf( c->cmd, sizeof(c->cmd), "%s", cmd );
+  cmdqn++;
+
+  sprintf( message, "Received: %s", c->cmd );
+  syslog( LOG_DEBUG, "%s", message );
+
+  evloop_schedule( &ev, cmdtask, 0 );
+}
+
+// close client connection and forget its queued commands
+void client_close(int fd)
+{
+  int i;
+  struct swclient *cl = client_find( fd );
+
+  for( i = 0; i < cmdqn; i++ )
+  {
+    if( cmdq[ ( cmdqfirst + i ) % CMDQMAX ].fd == fd ) cmdq[ ( cmdqfirst + i ) % CMDQMAX ].fd = -1;
+  }
+
+  if( cl != NULL )
+  {
+    if( cl->eof == 0 ) evloop_unwatch( &ev, fd );
+    cl->fd = -1;
+  }
+  close( fd );
+}
+
+// take text without newline as one command, it is the whole request of a
+// one-shot client that waits for the reply without closing
+void client_line(struct swclient *cl)
+{
+  if( cl->len == 0 ) return;
+
+  cl->line[ cl->len ] = 0;
+  cl->len = 0;
+  queue_cmd( cl->fd, cl->line, 0 );
+}
+
+// read commands from client, commands end with newline on a persistent
+// connection and the text after the last newline is kept until the rest
+// arrives, text without newline is a command at end of file or when no
+// more data comes in CLIENTIDLE seconds
+void client_ready(int fd)
+{
+  int n, i, start;
+  struct swclient *cl = client_find( fd );
+  char rbuff[ CLIENTLINE ];
+
+  if( cl == NULL ) return;
+
+  n = read( fd, rbuff, sizeof(rbuff) );
+  if( n <= 0 )
+  {
+    if( n < 0 )
+    {
+      if( errno == EAGAIN || errno == EINTR ) return;
+      syslog( LOG_ERR | LOG_DAEMON, "Socket reading failed" );
+      client_close( fd );
+      return;
+    }
+// replies can still be sent after end of file
+    evloop_unwatch( &ev, fd );
+    cl->eof = 1;
+    client_line( cl );
+    client_done( fd );
+    return;
+  }
+  cl->last = evloop_now();
+
+  for( i = 0, start = 0; i < n; i++ )
+  {
+    if( rbuff[ i ] != '\n' ) continue;
+    if( cl->len + i - start < CLIENTLINE )
+    {
+      memcpy( &cl->line[ cl->len ], &rbuff[ start ], i - start );
+      cl->len += i - start;
+      if( cl->len > 0 && cl->line[ cl->len - 1 ] == '\r' ) cl->len--;
+      cl->line[ cl->len ] = 0;
+      queue_cmd( fd, cl->line, 1 );
+      if( client_find( fd ) == NULL ) return;
+    }
+    else
+    {
+      syslog( LOG_ERR | LOG_DAEMON, "Command too long" );
+      client_send( fd, "error: too long\n" );
+      if( client_find( fd ) == NULL ) return;
+    }
+    cl->len = 0;
+    start = i + 1;
+  }
+
+  if( start < n )
+  {
+    if( cl->len + n - start >= CLIENTLINE )
+    {
+      syslog( LOG_ERR | LOG_DAEMON, "Command too long" );
+      client_send( fd, "error: too long\n" );
+      cl->len = 0;
+      return;
+    }
+    memcpy( &cl->line[ cl->len ], &rbuff[ start ], n - start );
+    cl->len += n - start;
+    evloop_schedule( &ev, linetask, CLIENTIDLE );
+  }
+}
+
+// text without newline left idle for CLIENTIDLE seconds is a command
+double task_line()
+{
+  int i;
+  double now = evloop_now();
+  double next = -1, d;
+
+  for( i = 0; i < CLIENTMAX; i++ )
+  {
+    if( clients[ i ].fd < 0 || clients[ i ].len == 0 ) continue;
+    d = clients[ i ].last + CLIENTIDLE - now;
+    if( d <= 0 ) client_line( &clients[ i ] );
+    else if( next < 0 || d < next ) next = d;
+  }
+
+  return next;
+}
+
+// send replies left for slow clients
+double task_out()
+{
+  int i, ok, fd;
+  double next = -1;
+
+  for( i = 0; i < CLIENTMAX; i++ )
+  {
+    if( clients[ i ].fd < 0 || clients[ i ].outlen == 0 ) continue;
+    fd = clients[ i ].fd;
+    ok = client_flush( &clients[ i ] );
+    if( ok < 0 ) client_close( fd );
+    else if( ok == 0 ) next = CLIENTRETRY;
+    else client_done( fd );
+  }
+
+  return next;
+}
+
+// accept new client
+void client_accept(int fd)
+{
+  int connfd;
+  struct swclient *cl;
+
+  connfd = accept( fd, NULL, NULL );
+  if( connfd < 0 )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Socket accept failed" );
+    return;
+  }
+
+  cl = client_find( -1 );
+  if( cl == NULL )
+  {
+    syslog( LOG_ERR | LOG_DAEMON, "Too many clients" );
+    close( connfd );
+    return;
+  }
+
+  if( evloop_watch( &ev, connfd, &client_ready ) != 1 )
+  {
+    close( connfd );
+    return;
+  }
+  cl->fd = connfd;
+  cl->eof = 0;
+  cl->len = 0;
+  cl->outlen = 0;
+  cl->last = evloop_now();
+  syslog( LOG_INFO | LOG_DAEMON, "Socket accepted" );
+}
+
 int cont = 1; /* main loop flag */
 
 void stop(int sig)
@@ -511,10 +1056,20 @@ void stop(int sig)
   cont = 0;
 }
 
+volatile sig_atomic_t termsig = 0; // 1=SIGTERM received
+
+// the switches are set from the main loop after SIGTERM so that the
+// handler does not use the i2c session in the middle of a transfer
 void terminate(int sig)
 {
-  sprintf( message, "signal %d catched", sig );
-  syslog( LOG_NOTICE | LOG_DAEMON, "%s", message );
+  termsig = 1;
+  cont = 0;
+}
+
+// set switches to their stop states
+void stop_switches()
+{
+  syslog( LOG_NOTICE | LOG_DAEMON, "signal %d catched", SIGTERM );
 
   sleep( 1 );
   operate_switch1( stopswitch1, 0 );
@@ -522,10 +1077,6 @@ void terminate(int sig)
 
   sleep( 1 );
   syslog( LOG_NOTICE | LOG_DAEMON, "stop" );
-
-  cont = 0;
-
-  exit( EXIT_SUCCESS );
 }
 
 void hup(int sig)
@@ -535,9 +1086,18 @@ void hup(int sig)
 }
 
 
+volatile sig_atomic_t dumpstats = 0; // 1=write i2c statistics to file
+
+// the statistics file is written from the main loop after SIGUSR1
+void usr1(int sig)
+{
+  dumpstats = 1;
+}
+
 int main()
 {  
   int ok = 0;
+  int i;
 
   setlogmask( LOG_UPTO (loglev) );
   syslog( LOG_NOTICE | LOG_DAEMON, "pipicswd v. %d started", version );
@@ -546,8 +1106,11 @@ int main()
   signal( SIGTERM, &terminate ); 
   signal( SIGQUIT, &stop ); 
   signal( SIGHUP, &hup ); 
+  signal( SIGUSR1, &usr1 ); 
 
   read_config(); // read configuration file
+  picclock_init( &pclock, picycle, ( clockint > 0 ) ? cyclefile : NULL );
+  picycle = pclock.cycle;
 
   int i2cok = testi2c(); // test i2c data flow to PIC 
   if( i2cok == 1 ) syslog( LOG_NOTICE | LOG_DAEMON, "i2c dataflow test ok" ); 
@@ -641,12 +1204,9 @@ int main()
   fclose( pidf );
 
 // open socket
-  int sockfd, connfd, clilen;
-  char rbuff[ 25 ];
-  char sbuff[ 200] ;
-  struct sockaddr_in serv_addr, cli_addr; 
+  struct sockaddr_in serv_addr; 
 
-  sockfd = socket( AF_INET, SOCK_STREAM, 0 );
+  sockfd = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
   if( sockfd < 0 ) 
   {
     syslog( LOG_ERR | LOG_DAEMON, "Could not open socket" );
@@ -655,7 +1215,6 @@ int main()
   else syslog( LOG_NOTICE | LOG_DAEMON, "Socket open" );
   
   memset( &serv_addr, '0', sizeof(serv_addr) );
-  memset( sbuff, '0', sizeof(sbuff) ); 
 
   serv_addr.sin_family = AF_INET;
   serv_addr.sin_addr.s_addr = htonl( INADDR_ANY );
@@ -668,109 +1227,52 @@ int main()
   }
   else syslog( LOG_NOTICE | LOG_DAEMON, "Socket binding successful" );
 
-  listen( sockfd, 1 ); // listen one client only 
-  clilen = sizeof( cli_addr );
+  listen( sockfd, 16 );
+
+// firmware with command 0x07 gives the timed task state in one transfer
+  bulkread = testbulk();
+  if( bulkread == 1 ) syslog( LOG_INFO | LOG_DAEMON, "timed tasks read with one transfer" );
 
 // initialize switches
   ok = operate_switch1( initswitch1, 0 );
   ok = operate_switch2( initswitch2, 0 );
  
-  sleep( 1 );
   ok = read_status();
 
-  int n = 0;
-  int hh = 0,mm = 0,wtime = 0;
-  while( cont == 1 )
+  if( evloop_init( &ev ) != 1 || evloop_watch( &ev, sockfd, &client_accept ) != 1 )
   {
-    connfd = accept( sockfd, (struct sockaddr*)&cli_addr, (socklen_t *)&clilen ); 
-    if( connfd < 0 ) 
-    {
-      syslog( LOG_ERR | LOG_DAEMON, "Socket accept failed" );
-      exit( EXIT_FAILURE );
-    }
-    else syslog( LOG_INFO | LOG_DAEMON, "Socket accepted" );
-
-    bzero( rbuff, 25 );
-    n = read( connfd, rbuff, 24 );
-    if( n < 0 )
-    {
-      syslog( LOG_ERR | LOG_DAEMON, "Socket reading failed" );
-      exit( EXIT_FAILURE );
-    }
-    else
-    {
-      sprintf( message, "Received: %s", rbuff );
-      syslog( LOG_DEBUG, "%s", message );
-    }
-
-    if( strncmp( rbuff, "open 1", 6 ) == 0 )
-    {
-      if( sscanf( rbuff, "open 1 %d:%d", &hh, &mm ) != EOF )
-      {
-        wtime = calcwtime( hh, mm );
-        ok = operate_switch1( 2, wtime );
-      }
-      else ok = operate_switch1( 2, 0 ); 
-      sleep( 1 );
-    } 
-    else if( strncmp( rbuff, "close 1", 7 ) == 0 )
-    {
-      if( sscanf( rbuff, "close 1 %d:%d", &hh, &mm ) != EOF )
-      {
-        wtime = calcwtime( hh, mm );
-        ok = operate_switch1( 1 ,wtime );
-      }
-      else ok = operate_switch1( 1, 0 );
-      sleep( 1 );
-    } 
-    else if( strncmp( rbuff, "open 2", 6 ) == 0 )
-    {
-      if( sscanf( rbuff, "open 2 %d:%d", &hh, &mm ) != EOF )
-      {
-        wtime = calcwtime( hh, mm );
-        ok = operate_switch2( 2, wtime );
-      }
-      else ok = operate_switch2( 2, 0 );
-      sleep( 1 );
-    } 
-    else if( strncmp( rbuff, "close 2", 7 ) == 0 )
-    {
-      if( sscanf( rbuff, "close 2 %d:%d", &hh, &mm ) != EOF )
-      {
-        wtime = calcwtime( hh, mm );
-        ok = operate_switch2( 1, wtime );
-      }
-      else ok = operate_switch2( 1, 0 );
-      sleep( 1 );
-    } 
-    else if( strncmp( rbuff, "cancel 1", 8 ) == 0 )
-    {
-      ok = timer1cancel();
-    }
-    else if( strncmp( rbuff, "cancel 2", 8) == 0 )
-    {
-      ok = timer2cancel();
-    }
+    syslog( LOG_ERR | LOG_DAEMON, "Could not start event loop" );
+    exit( EXIT_FAILURE );
+  }
+  for( i = 0; i < CLIENTMAX; i++ ) clients[ i ].fd = -1;
+  cmdtask = evloop_task( &ev, &task_cmd, -1 );
+  linetask = evloop_task( &ev, &task_line, -1 );
+  outtask = evloop_task( &ev, &task_out, -1 );
+  statustask = evloop_task( &ev, &task_status, 0 );
+  if( clockint > 0 ) evloop_task( &ev, &task_clock, 0 );
 
-    ok = read_status();
-    snprintf( sbuff, sizeof(sbuff), "%s", status );
+  statfd = i2c_stats_listen( statsock );
+  if( statfd >= 0 ) evloop_watch( &ev, statfd, &i2c_stats_serve );
 
-    n = write( connfd, sbuff, strlen( sbuff ) ); 
-    if( n < 0 )
-    {
-      syslog( LOG_ERR | LOG_DAEMON, "Socket writing failed" );
-      exit( EXIT_FAILURE );
-    }
-    else
+  while( cont == 1 )
+  {
+    if( evloop_run( &ev ) < 0 ) cont = 0;
+    if( dumpstats == 1 )
     {
-      sprintf( message, "Send: %s", sbuff );
-      syslog( LOG_DEBUG, "%s", message );
+      dumpstats = 0;
+      i2c_stats_dump( statsfile );
     }
+  }
 
-    close( connfd );
-
-    sleep( 1 );
+  evloop_close( &ev );
+  if( statfd >= 0 )
+  {
+    close( statfd );
+    unlink( statsock );
   }
+  close( sockfd );
+
+  if( termsig == 1 ) stop_switches();
 
   syslog( LOG_NOTICE | LOG_DAEMON, "remove PID file" );
   ok = remove( pidfile );
@@ -20,7 +20,7 @@
 ****************************************************************************
 *
 * Wed Aug 14 22:33:01 CEST 2013
-* Edit: Thu Sep 11 21:46:23 CEST 2014
+* Edit: Sat Oct 17 22:41:09 CDT 2026
 *
 * Jaakko Koivuniemi
 **/
@@ -37,6 +37,14 @@
 #include <getopt.h>
 #include <errno.h>
 #include <time.h>
+#include "i2csession.h"
+#include "i2cstats.h"
+
+#define BENCHOPS 5 // number of different operations in mixed benchmark
+
+const char *i2cdev="/dev/i2c-1"; // i2c device file
+const int address=0x26; // default PiPIC i2c address
+const int i2lockmax=10; // maximum number of times to try lock i2c port
 
 int printime()
 {
@@ -55,12 +63,220 @@ int printime()
 
 void printusage()
 {
-  printf("usage: pipictest -a address [-n N] [-i] [-c] [-0] [-1] [-3] [-h] [-v] [-V]\n");
+  printf("usage: pipictest -a address [-n N] [-i] [-c] [-0] [-1] [-3] [-b mode] [-j file] [-f] [-h] [-v] [-V]\n");
 }
 
 void printversion()
 {
-  printf("pipictest v. 20140911, Jaakko Koivuniemi\n");
+  printf("pipictest v. 20261017, Jaakko Koivuniemi\n");
+}
+
+// monotonic time in seconds
+double now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+
+  return ts.tv_sec+1e-9*ts.tv_nsec;
+}
+
+// write to i2c slave with the port locked like the daemons do
+// return: 1=ok, otherwise error from i2c session
+int xwrite(const unsigned char *buf, int n)
+{
+  int ok;
+
+  ok=i2c_session_lock(&i2cses);
+  if(ok!=1) return ok;
+  ok=i2c_session_write(&i2cses,buf,n);
+  i2c_session_unlock(&i2cses);
+
+  return ok;
+}
+
+// read from i2c slave with the port locked
+// return: 1=ok, otherwise error from i2c session
+int xread(unsigned char *buf, int n)
+{
+  int ok;
+
+  ok=i2c_session_lock(&i2cses);
+  if(ok!=1) return ok;
+  ok=i2c_session_read(&i2cses,buf,n);
+  i2c_session_unlock(&i2cses);
+
+  return ok;
+}
+
+// number of differing bits in n bytes
+int biterrors(const unsigned char *a, const unsigned char *b, int n)
+{
+  int i,x,cnt=0;
+
+  for(i=0;i<n;i++)
+  {
+     for(x=a[i]^b[i];x!=0;x&=x-1) cnt++;
+  }
+  return cnt;
+}
+
+int cmpdouble(const void *a, const void *b)
+{
+  double d=*(const double*)a-*(const double*)b;
+
+  return (d>0)-(d<0);
+}
+
+// one benchmark operation, mode echo writes four random bytes with 0x02
+// and reads them back, cmd only writes them, read only reads back the
+// bytes written before the benchmark and mixed goes through the reads
+// pipicpowerd and pipicswd do: voltage 0x43, timer 0x51, GPIO register
+// 0x01 0x05, timed tasks 0x07 0x27 and the echo test, a command with
+// reply is one i2c_session_xfer() as in the daemons
+// return: 1=ok, -1=transfer failed
+int benchop(const char *mode, int k, unsigned char *pattern, long *nbytes, long *nbits, long *biterr)
+{
+  unsigned char buf[32];
+  unsigned char send[5];
+  int i,op;
+  int rlen=0;
+
+  op=BENCHOPS-1;
+  if(strcmp(mode,"cmd")==0) op=5;
+  if(strcmp(mode,"read")==0) op=6;
+  if(strcmp(mode,"mixed")==0) op=k%BENCHOPS;
+
+  if(op==5||op==BENCHOPS-1)
+  {
+     send[0]=0x02;
+     for(i=1;i<5;i++) send[i]=rand();
+     if(op==5)
+     {
+        if(xwrite(send,5)!=1) return -1;
+        *nbytes+=5;
+        return 1;
+     }
+     if(i2c_session_xfer(&i2cses,send,5,buf,4)!=1) return -1;
+     *nbytes+=9;
+     *nbits+=32;
+     *biterr+=biterrors(&send[1],buf,4);
+     return 1;
+  }
+
+  if(op==6)
+  {
+     if(xread(buf,4)!=1) return -1;
+     *nbytes+=4;
+     *nbits+=32;
+     *biterr+=biterrors(pattern,buf,4);
+     return 1;
+  }
+
+  send[0]=0x43;
+  send[1]=0;
+  if(op==0) rlen=2;
+  if(op==1)
+  {
+     send[0]=0x51;
+     rlen=4;
+  }
+  if(op==2)
+  {
+     send[0]=0x01;
+     send[1]=0x05;
+     rlen=1;
+  }
+  if(op==3)
+  {
+     send[0]=0x07;
+     send[1]=0x27;
+     rlen=18;
+  }
+  if(i2c_session_xfer(&i2cses,send,(send[1]==0)?1:2,buf,rlen)!=1) return -1;
+  *nbytes+=((send[1]==0)?1:2)+rlen;
+
+  return 1;
+}
+
+// run n benchmark operations and print the latency percentiles, rates
+// and error counts, optionally also as JSON to file
+// return: 0=ok, -1=failed
+int benchmark(int address, const char *mode, int n, const char *jsonfile, int verb)
+{
+  double *lat;
+  double t0,t1,t2,elapsed,sum=0;
+  unsigned char pattern[5]={0x02,0xA5,0x5A,0xF0,0x0F};
+  long nbytes=0,nbits=0,biterr=0,nfail=0;
+  int i,ok=0;
+  FILE *jf;
+
+  if(strcmp(mode,"echo")!=0&&strcmp(mode,"cmd")!=0&&strcmp(mode,"read")!=0&&strcmp(mode,"mixed")!=0)
+  {
+     printusage();
+     return -1;
+  }
+
+  lat=malloc(n*sizeof(double));
+  if(lat==NULL)
+  {
+     perror("Could not allocate memory");
+     return -1;
+  }
+
+// the read benchmark reads back a known pattern
+  if(strcmp(mode,"read")==0&&xwrite(pattern,5)!=1)
+  {
+     perror("Error writing to i2c slave");
+     free(lat);
+     return -1;
+  }
+
+  t0=now();
+  for(i=0;i<n;i++)
+  {
+     t1=now();
+     ok=benchop(mode,i,&pattern[1],&nbytes,&nbits,&biterr);
+     t2=now();
+     lat[i-nfail]=t2-t1;
+     if(ok!=1)
+     {
+        nfail++;
+        if(verb==1) perror("Transfer failed");
+     }
+  }
+  elapsed=now()-t0;
+
+  n-=nfail;
+  for(i=0;i<n;i++) sum+=lat[i];
+  qsort(lat,n,sizeof(double),&cmpdouble);
+
+  printf("%s: %d operations in %.3f s, %.1f operations/s, %.0f bytes/s\n",mode,n,elapsed,(elapsed>0)?n/elapsed:0,(elapsed>0)?nbytes/elapsed:0);
+  if(n>0) printf("latency mean %.1f us p50 %.1f us p99 %.1f us max %.1f us\n",1e6*sum/n,1e6*lat[n/2],1e6*lat[(int)(0.99*(n-1))],1e6*lat[n-1]);
+  printf("failed transfers %ld, bit errors %ld in %ld bits\n",nfail,biterr,nbits);
+  if(verb==1) i2c_stats_print(stdout);
+
+  if(jsonfile!=NULL)
+  {
+     jf=fopen(jsonfile,"w");
+     if(jf==NULL)
+     {
+        perror("Could not open JSON file");
+        free(lat);
+        return -1;
+     }
+     fprintf(jf,"{\"mode\": \"%s\", \"address\": %d, \"busd\": %s, ",mode,address,(i2cses.busd==1)?"true":"false");
+     fprintf(jf,"\"operations\": %d, \"failed\": %ld, \"seconds\": %.6f, ",n,nfail,elapsed);
+     fprintf(jf,"\"ops_per_s\": %.1f, \"bytes\": %ld, \"bytes_per_s\": %.1f, ",(elapsed>0)?n/elapsed:0,nbytes,(elapsed>0)?nbytes/elapsed:0);
+     fprintf(jf,"\"bits_checked\": %ld, \"bit_errors\": %ld",nbits,biterr);
+     if(n>0) fprintf(jf,", \"latency_us\": {\"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}",1e6*sum/n,1e6*lat[n/2],1e6*lat[(int)(0.99*(n-1))],1e6*lat[n-1]);
+     fprintf(jf,"}\n");
+     fclose(jf);
+  }
+
+  free(lat);
+
+  return 0;
 }
 
 int main(int argc, char **argv)
@@ -82,11 +298,13 @@ int main(int argc, char **argv)
   int rtime=0; // cycle time from PIC
   int t1=0,t2=0,dt=0; // start and end time of cycle count
   int ain0=0,ain1=0,ain3=0; // analog input voltage
+  char *bmode=NULL; // benchmark mode echo, cmd, read or mixed
+  char *jsonfile=NULL; // benchmark result file
 
   int optch=0;
   while(optch!=-1)
     {
-      optch=getopt(argc,argv,"a:n:i013chvV");
+      optch=getopt(argc,argv,"a:n:i013b:j:fchvV");
       if(optch=='a')
 	{
 	  sscanf(optarg,"%X",&address);
@@ -115,6 +333,18 @@ int main(int argc, char **argv)
 	{
           analog3=1;          
 	}
+      if(optch=='b')
+	{
+          bmode=optarg;
+	}
+      if(optch=='j')
+	{
+          jsonfile=optarg;
+	}
+      if(optch=='f')
+	{
+          i2cses.busd=1;
+	}
       if(optch=='v')
 	{
           verb=1;
@@ -137,6 +367,28 @@ int main(int argc, char **argv)
       return -1;
     }
 
+  if((i2cses.busd==1)&&(bmode==NULL))
+    {
+      printusage();
+      return -1;
+    }
+
+// the benchmark goes through the same i2c session as the daemons
+  if(bmode!=NULL)
+    {
+      i2cses.dev=fileName;
+      i2cses.addr=address;
+      i2cses.lockmax=i2lockmax;
+      if(i2c_session_open(&i2cses)!=1)
+	{
+	  fprintf(stderr,"Could not open i2c port\n");
+	  return -1;
+	}
+      i=benchmark(address,bmode,nrpt,jsonfile,verb);
+      i2c_session_close(&i2cses);
+      return i;
+    }
+
 // open port for reading and writing
   if(verb==1) printf("Open %s\n", fileName);
   if((fd = open(fileName, O_RDWR)) < 0) 
@@ -1,102 +1,111 @@
 #include "readdata.h"
 #include <string.h>
 #include <stdio.h>
-#include <unistd.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
-#include <sys/file.h>
 #include <syslog.h>
-#include "pipichbd.h"
+#include <unistd.h>
+#include "i2csession.h"
 
-// read data with i2c from PIC, length is the number of bytes to read 
-// return: -1=open failed, -2=lock failed, -3=bus access failed, 
-// -4=i2c slave reading failed
-int read_data(int length)
+// convert received bytes to integer, length can be 1, 2 or 4
+int data_value(const unsigned char *buf, int length)
 {
   int rdata = 0;
-  int fd, rd;
-  int cnt = 0;
-  unsigned char buf[ 10 ];
   char message[ 200 ] = "";
 
-  if( (fd = open( i2cdev, O_RDWR) ) < 0) 
+  if( length == 1 )
   {
-    syslog( LOG_ERR, "Failed to open i2c port");
-    return -1;
+     sprintf( message, "Receive 0x%02x", buf[ 0 ] );
+     rdata = buf[ 0 ];
   }
-
-  rd = flock(fd, LOCK_EX | LOCK_NB);
-
-  cnt = i2lockmax;
-  while( rd != 0 && cnt > 0 ) // try again if port locking failed
+  else if( length == 2 )
   {
-    sleep( 1 );
-    rd = flock( fd, LOCK_EX | LOCK_NB);
-    cnt--;
+     sprintf( message, "Receive 0x%02x%02x", buf[0], buf[1] );
+     rdata = 256 * buf[0] + buf[1];
   }
-  if( rd )
+  else if( length == 4 )
   {
-    syslog( LOG_ERR, "Failed to lock i2c port");
-    close( fd );
-    return -2;
+     sprintf( message, "Receive 0x%02x%02x%02x%02x", buf[0], buf[1], buf[2], buf[3] );
+     rdata = 16777216 * buf[ 0 ] + 65536 * buf[ 1 ] + 256 * buf[ 2 ] + buf[ 3 ];
   }
+  syslog( LOG_DEBUG, "%s", message );
 
-  if( ioctl( fd, I2C_SLAVE, address) < 0 ) 
-  {
-    syslog( LOG_ERR, "Unable to get bus access to talk to slave");
-    close( fd );
-    return -3;
-  }
+  return rdata;
+}
 
-  if( length == 1 )
-  {
-     if( read( fd, buf, 1 ) != 1 ) 
-     {
-       syslog( LOG_ERR, "Unable to read from slave");
-       close( fd );
-       return -4;
-     }
-     else 
-     {
-       sprintf( message, "Receive 0x%02x", buf[ 0 ] );
-       syslog( LOG_DEBUG, "%s", message); 
-       rdata = buf[ 0 ];
-     }
-  } 
-  else if( length == 2 )
+// read data with i2c from PIC, length is the number of bytes to read
+// return: -1=open failed, -2=lock failed, -3=bus access failed,
+// -4=i2c slave reading failed
+int read_data(int length)
+{
+  int ok;
+  unsigned char buf[ 10 ];
+
+  if( length != 1 && length != 2 && length != 4 ) return 0;
+
+  ok = i2c_session_lock( &i2cses );
+  if( ok != 1 ) return ok;
+
+  ok = i2c_session_read( &i2cses, buf, length );
+
+  i2c_session_unlock( &i2cses );
+
+  if( ok != 1 ) return ok;
+
+  return data_value( buf, length );
+}
+
+// decode reply of command 0x44 for n conversions, sum, minimum and maximum
+// as 16-bit words, the reply is checked to be consistent
+// return: 1=ok, -4=inconsistent reply
+int adc_value(const unsigned char *buf, int n, struct adcsum *adc)
+{
+  adc->n = n;
+  adc->sum = 256 * buf[ 0 ] + buf[ 1 ];
+  adc->min = 256 * buf[ 2 ] + buf[ 3 ];
+  adc->max = 256 * buf[ 4 ] + buf[ 5 ];
+
+  syslog( LOG_DEBUG, "Receive sum %d min %d max %d of %d conversions", adc->sum, adc->min, adc->max, n );
+
+  if( adc->min > adc->max || adc->max > 1023 ) return -4;
+  if( adc->sum < n * adc->min || adc->sum > n * adc->max ) return -4;
+
+  return 1;
+}
+
+// n back-to-back A/D conversions on channel ch 0, 1 or 3 summed on PIC
+// with command 0x44, the reply is read after the conversions are done and
+// the PIC is kept reserved in between
+// return: 1=ok, 0=bad parameter, -4=i2c failed or inconsistent reply,
+// otherwise error from i2c_session_lock()
+int read_adc(int ch, int n, struct adcsum *adc)
+{
+  int ok;
+  unsigned char wbuf[ 3 ];
+  unsigned char rbuf[ 6 ];
+
+  if( ch < 0 || ch > 3 || ch == 2 || n < 1 || n > ADCSUMMAX ) return 0;
+
+  wbuf[ 0 ] = 0x44;
+  wbuf[ 1 ] = ch;
+  wbuf[ 2 ] = n & 0x3F;
+
+  ok = i2c_session_lock( &i2cses );
+  if( ok != 1 ) return ok;
+
+  ok = i2c_session_lock( &i2cses ); // nested lock holds slave in pipicbusd
+  if( ok == 1 )
   {
-     if( read( fd, buf, 2 ) != 2 ) 
-     {
-       syslog( LOG_ERR, "Unable to read from slave");
-       close( fd );
-       return -4;
-     }
-     else 
-     {
-       sprintf( message, "Receive 0x%02x%02x", buf[0], buf[1] );
-       syslog( LOG_DEBUG, "%s", message);  
-       rdata = 256 * buf[0] + buf[1];
-     }
+    ok = i2c_session_write( &i2cses, wbuf, 3 );
+    i2c_session_unlock( &i2cses );
   }
-  else if( length == 4 )
+  if( ok == 1 )
   {
-     if( read( fd, buf, 4) != 4 ) 
-     {
-       syslog( LOG_ERR, "Unable to read from slave");
-       close( fd );
-       return -4;
-     }
-     else 
-     {
-        sprintf( message, "Receive 0x%02x%02x%02x%02x", buf[0], buf[1], buf[2], buf[3] );
-        syslog( LOG_DEBUG, "%s", message);  
-        rdata = 16777216 * buf[ 0 ] + 65536 * buf[ 1 ] + 256 * buf[ 2 ] + buf[ 3 ];
-     }
+    usleep( 1000 + 100 * n );
+    ok = i2c_session_read( &i2cses, rbuf, 6 );
   }
 
-  close( fd );
-
-  return rdata;
-}
+  i2c_session_unlock( &i2cses );
 
+  if( ok != 1 ) return ok;
 
+  return adc_value( rbuf, n, adc );
+}
@@ -1,4 +1,15 @@
 #ifndef READDATA_H_INCLUDED
 #define READDATA_H_INCLUDED
+#define ADCSUMMAX 64 // maximum number of conversions summed on PIC
+struct adcsum
+{
+  int n; // number of conversions
+  int sum; // sum of conversions
+  int min; // smallest conversion
+  int max; // largest conversion
+};
+int data_value(const unsigned char *buf, int length);
 int read_data(int length);
+int adc_value(const unsigned char *buf, int n, struct adcsum *adc);
+int read_adc(int ch, int n, struct adcsum *adc);
 #endif
@@ -0,0 +1,385 @@
+#include "statlog.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <syslog.h>
+#include <unistd.h>
+
+// each power up period is one fixed size little endian record appended to
+// the log, the day file has one record for each day with power ups giving
+// the summed uptime and where its records start in the log, so summing
+// the uptime of the last days reads only the end of the day file
+
+// the days are in log order, a power up with the clock set wrong starts a
+// day out of order, so this many older days are passed before the end of
+// the day file is known to be read
+#define STATDAYSKIP 31
+
+static void putle(unsigned char *buf, uint32_t v, int n)
+{
+  int i;
+
+  for( i = 0; i < n; i++ ) buf[ i ] = ( v >> ( 8 * i ) ) & 0xFF;
+}
+
+static uint32_t getle(const unsigned char *buf, int n)
+{
+  int i;
+  uint32_t v = 0;
+
+  for( i = n - 1; i >= 0; i-- ) v = ( v << 8 ) | buf[ i ];
+
+  return v;
+}
+
+// voltages and temperatures are kept as signed hundredths
+static void putf(unsigned char *buf, float v)
+{
+  putle( buf, (uint16_t)(int16_t)( ( v < 0 ) ? 100 * v - 0.5 : 100 * v + 0.5 ), 2 );
+}
+
+static float getf(const unsigned char *buf)
+{
+  return (int16_t)getle( buf, 2 ) / 100.0;
+}
+
+static void statday_put(unsigned char *buf, const struct statday *d)
+{
+  putle( &buf[ 0 ], d->day, 4 );
+  putle( &buf[ 4 ], d->uptime, 4 );
+  putle( &buf[ 8 ], d->nrec, 4 );
+  putle( &buf[ 12 ], d->first, 4 );
+}
+
+static void statday_get(const unsigned char *buf, struct statday *d)
+{
+  d->day = getle( &buf[ 0 ], 4 );
+  d->uptime = getle( &buf[ 4 ], 4 );
+  d->nrec = getle( &buf[ 8 ], 4 );
+  d->first = getle( &buf[ 12 ], 4 );
+}
+
+// read next record from log
+// return: 1=ok, 0=end of file
+int statlog_read(FILE *f, struct statrec *r)
+{
+  unsigned char buf[ STATRECSIZE ];
+
+  if( fread( buf, STATRECSIZE, 1, f ) != 1 ) return 0;
+
+  r->logtime = getle( &buf[ 0 ], 4 );
+  r->start = getle( &buf[ 4 ], 4 );
+  r->stop = getle( &buf[ 8 ], 4 );
+  r->timerstart = getle( &buf[ 12 ], 4 );
+  r->timerstop = getle( &buf[ 16 ], 4 );
+  r->dt = getle( &buf[ 20 ], 4 );
+  r->wifiuptime = getle( &buf[ 24 ], 4 );
+  r->Vmin = getf( &buf[ 28 ] );
+  r->Vave = getf( &buf[ 30 ] );
+  r->Vmax = getf( &buf[ 32 ] );
+  r->Tmin = getf( &buf[ 34 ] );
+  r->Tave = getf( &buf[ 36 ] );
+  r->Tmax = getf( &buf[ 38 ] );
+  r->Tcpumin = getf( &buf[ 40 ] );
+  r->Tcpuave = getf( &buf[ 42 ] );
+  r->Tcpumax = getf( &buf[ 44 ] );
+
+  return 1;
+}
+
+// read next record from day file
+// return: 1=ok, 0=end of file
+int statlog_readday(FILE *f, struct statday *d)
+{
+  unsigned char buf[ STATDAYSIZE ];
+
+  if( fread( buf, STATDAYSIZE, 1, f ) != 1 ) return 0;
+  statday_get( buf, d );
+
+  return 1;
+}
+
+// print record as a line of the old text log
+void statlog_text(FILE *f, const struct statrec *r)
+{
+  time_t t = r->logtime;
+  char tstr[ 25 ];
+
+  strftime( tstr, 25, "%Y-%m-%d %H:%M:%S", localtime( &t ) );
+
+  fprintf( f, "%s %u %u", tstr, r->start, r->stop );
+  fprintf( f, " %d %d %d", r->timerstart, r->timerstop, r->dt );
+  fprintf( f, " %5.2f %5.2f %5.2f", r->Vmin, r->Vave, r->Vmax );
+  fprintf( f, " %+5.2f %+5.2f %+5.2f", r->Tmin, r->Tave, r->Tmax );
+  fprintf( f, " %+5.2f %+5.2f %+5.2f", r->Tcpumin, r->Tcpuave, r->Tcpumax );
+  fprintf( f, " %d\n", r->wifiuptime );
+}
+
+// add record of index n in log to the last day of the day file or start
+// a new day
+// return: 1=ok, -1=day file could not be written
+static int statlog_addday(FILE *df, const struct statrec *r, unsigned n)
+{
+  unsigned char buf[ STATDAYSIZE ];
+  struct statday d;
+  long size;
+
+  fseek( df, 0, SEEK_END );
+  size = ftell( df );
+  size -= size % STATDAYSIZE;
+
+  d.day = 0;
+  if( size >= STATDAYSIZE )
+  {
+    fseek( df, size - STATDAYSIZE, SEEK_SET );
+    if( fread( buf, STATDAYSIZE, 1, df ) == 1 ) statday_get( buf, &d );
+  }
+
+  if( size >= STATDAYSIZE && d.day == r->start / 86400 )
+  {
+    if( r->dt > 0 ) d.uptime += r->dt;
+    d.nrec++;
+    fseek( df, size - STATDAYSIZE, SEEK_SET );
+  }
+  else
+  {
+    d.day = r->start / 86400;
+    d.uptime = ( r->dt > 0 ) ? r->dt : 0;
+    d.nrec = 1;
+    d.first = n;
+    fseek( df, size, SEEK_SET );
+  }
+
+  statday_put( buf, &d );
+  if( fwrite( buf, STATDAYSIZE, 1, df ) != 1 ) return -1;
+
+  return 1;
+}
+
+// open day file for update, it is created if missing
+static FILE *statlog_dayopen(const char *dayfile)
+{
+  FILE *df;
+
+  df = fopen( dayfile, "r+b" );
+  if( df == NULL ) df = fopen( dayfile, "w+b" );
+
+  return df;
+}
+
+// append record to log and update the day file, the day file is rebuilt
+// if it is missing, a partial record left by a power loss in the middle of
+// a write is cut away first so that the records stay aligned
+// return: 1=ok, -1=writing failed
+int statlog_append(const char *logfile, const char *dayfile, const struct statrec *r)
+{
+  FILE *lf, *df;
+  unsigned char buf[ STATRECSIZE ];
+  long n, size;
+  int ok;
+
+  putle( &buf[ 0 ], r->logtime, 4 );
+  putle( &buf[ 4 ], r->start, 4 );
+  putle( &buf[ 8 ], r->stop, 4 );
+  putle( &buf[ 12 ], r->timerstart, 4 );
+  putle( &buf[ 16 ], r->timerstop, 4 );
+  putle( &buf[ 20 ], r->dt, 4 );
+  putle( &buf[ 24 ], r->wifiuptime, 4 );
+  putf( &buf[ 28 ], r->Vmin );
+  putf( &buf[ 30 ], r->Vave );
+  putf( &buf[ 32 ], r->Vmax );
+  putf( &buf[ 34 ], r->Tmin );
+  putf( &buf[ 36 ], r->Tave );
+  putf( &buf[ 38 ], r->Tmax );
+  putf( &buf[ 40 ], r->Tcpumin );
+  putf( &buf[ 42 ], r->Tcpuave );
+  putf( &buf[ 44 ], r->Tcpumax );
+
+  lf = fopen( logfile, "ab" );
+  if( lf == NULL )
+  {
+    syslog( LOG_ERR, "Could not open statistics log %s", logfile );
+    return -1;
+  }
+  fseek( lf, 0, SEEK_END );
+  size = ftell( lf );
+  if( size % STATRECSIZE != 0 )
+  {
+    syslog( LOG_WARNING, "Cut partial record of %ld bytes from statistics log %s", size % STATRECSIZE, logfile );
+    size -= size % STATRECSIZE;
+    if( ftruncate( fileno( lf ), size ) != 0 )
+    {
+      syslog( LOG_ERR, "Could not cut statistics log %s", logfile );
+      fclose( lf );
+      return -1;
+    }
+  }
+  n = size / STATRECSIZE;
+  ok = ( fwrite( buf, STATRECSIZE, 1, lf ) == 1 );
+  fclose( lf );
+  if( !ok )
+  {
+    syslog( LOG_ERR, "Could not write statistics log %s", logfile );
+    return -1;
+  }
+
+  df = statlog_dayopen( dayfile );
+  if( df == NULL )
+  {
+    syslog( LOG_ERR, "Could not open statistics day file %s", dayfile );
+    return -1;
+  }
+  fseek( df, 0, SEEK_END );
+  if( n > 0 && ftell( df ) == 0 )
+  {
+    fclose( df );
+    return statlog_reindex( logfile, dayfile );
+  }
+  ok = statlog_addday( df, r, n );
+  fclose( df );
+
+  return ok;
+}
+
+// write the day file again from the whole log
+// return: 1=ok, -1=failed
+int statlog_reindex(const char *logfile, const char *dayfile)
+{
+  FILE *lf, *df;
+  struct statrec r;
+  unsigned n = 0;
+  int ok = 1;
+
+  lf = fopen( logfile, "rb" );
+  if( lf == NULL ) return -1;
+
+  df = fopen( dayfile, "w+b" );
+  if( df == NULL )
+  {
+    fclose( lf );
+    return -1;
+  }
+
+  while( ok == 1 && statlog_read( lf, &r ) == 1 ) ok = statlog_addday( df, &r, n++ );
+
+  fclose( df );
+  fclose( lf );
+  syslog( LOG_INFO, "Statistics day file %s written for %u records", dayfile, n );
+
+  return ok;
+}
+
+// convert old text log to binary log once, nothing is done if the binary
+// log exists already
+// return: number of records converted, -1=failed
+int statlog_import(const char *textfile, const char *logfile, const char *dayfile)
+{
+  FILE *tf, *lf;
+  char *line = NULL;
+  size_t len = 0;
+  char dat[ 100 ], tim[ 100 ];
+  struct statrec r;
+  struct tm tm;
+  int n = 0;
+
+  lf = fopen( logfile, "rb" );
+  if( lf != NULL )
+  {
+    fclose( lf );
+    return 0;
+  }
+
+  tf = fopen( textfile, "r" );
+  if( tf == NULL ) return 0;
+
+  while( getline( &line, &len, tf ) != -1 )
+  {
+    memset( &r, 0, sizeof(r) );
+    if( sscanf( line, "%99s %99s %u %u %d %d %d %f %f %f %f %f %f %f %f %f %d", dat, tim, &r.start, &r.stop, &r.timerstart, &r.timerstop, &r.dt, &r.Vmin, &r.Vave, &r.Vmax, &r.Tmin, &r.Tave, &r.Tmax, &r.Tcpumin, &r.Tcpuave, &r.Tcpumax, &r.wifiuptime ) < 7 ) continue;
+
+    memset( &tm, 0, sizeof(tm) );
+    tm.tm_isdst = -1;
+    if( sscanf( dat, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday ) == 3 && sscanf( tim, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec ) == 3 )
+    {
+      tm.tm_year -= 1900;
+      tm.tm_mon -= 1;
+      r.logtime = mktime( &tm );
+    }
+    else r.logtime = r.stop;
+
+    if( statlog_append( logfile, dayfile, &r ) != 1 )
+    {
+      n = -1;
+      break;
+    }
+    n++;
+  }
+  free( line );
+  fclose( tf );
+
+  if( n > 0 ) syslog( LOG_NOTICE, "Converted %d records from %s to %s", n, textfile, logfile );
+
+  return n;
+}
+
+// sum uptime of power ups started after t0, histok is set if there are
+// power ups between since and t0, the day file is read backwards until
+// STATDAYSKIP days in a row are before since and only the log records of
+// the day of t0 are read
+// return: uptime [s], -1=no day file
+float statlog_uptime(const char *logfile, const char *dayfile, unsigned t0, unsigned since, int *histok)
+{
+  FILE *df, *lf;
+  unsigned char buf[ STATDAYSIZE ];
+  struct statday d;
+  struct statrec r;
+  float uptime = 0;
+  long pos;
+  unsigned i;
+  int old = 0;
+
+  *histok = 0;
+
+  df = fopen( dayfile, "rb" );
+  if( df == NULL ) return -1;
+
+  fseek( df, 0, SEEK_END );
+  pos = ftell( df );
+  pos -= pos % STATDAYSIZE;
+
+  while( pos >= STATDAYSIZE )
+  {
+    pos -= STATDAYSIZE;
+    fseek( df, pos, SEEK_SET );
+    if( fread( buf, STATDAYSIZE, 1, df ) != 1 ) break;
+    statday_get( buf, &d );
+
+    if( d.day < since / 86400 )
+    {
+      if( ++old >= STATDAYSKIP ) break;
+      continue;
+    }
+    old = 0;
+
+    if( d.day > t0 / 86400 ) uptime += d.uptime;
+    else if( d.day < t0 / 86400 ) *histok = 1;
+    else
+    {
+// the day of t0 is summed from the log records
+      lf = fopen( logfile, "rb" );
+      if( lf == NULL ) break;
+      fseek( lf, (long)d.first * STATRECSIZE, SEEK_SET );
+      for( i = 0; i < d.nrec && statlog_read( lf, &r ) == 1; i++ )
+      {
+        if( r.start > t0 ) uptime += r.dt;
+        else if( r.start > since ) *histok = 1;
+      }
+      fclose( lf );
+    }
+  }
+  fclose( df );
+
+  return uptime;
+}
@@ -0,0 +1,33 @@
+#ifndef STATLOG_H_INCLUDED
+#define STATLOG_H_INCLUDED
+#include <stdio.h>
+#define STATRECSIZE 46 // bytes in one power up record
+#define STATDAYSIZE 16 // bytes in one day rollup record
+struct statrec
+{
+  unsigned logtime; // time record was written
+  unsigned start; // power up time
+  unsigned stop; // power down time
+  int timerstart; // PIC timer at power up
+  int timerstop; // PIC timer at power down
+  int dt; // uptime from PIC timer [s]
+  int wifiuptime; // time WiFi was up [s]
+  float Vmin, Vave, Vmax; // battery voltage [V]
+  float Tmin, Tave, Tmax; // temperature [C]
+  float Tcpumin, Tcpuave, Tcpumax; // CPU temperature [C]
+};
+struct statday
+{
+  unsigned day; // days since the epoch of power up time
+  unsigned uptime; // sum of uptimes [s]
+  unsigned nrec; // number of records
+  unsigned first; // index of first record in log
+};
+int statlog_append(const char *logfile, const char *dayfile, const struct statrec *r);
+int statlog_read(FILE *f, struct statrec *r);
+int statlog_readday(FILE *f, struct statday *d);
+void statlog_text(FILE *f, const struct statrec *r);
+int statlog_reindex(const char *logfile, const char *dayfile);
+int statlog_import(const char *textfile, const char *logfile, const char *dayfile);
+float statlog_uptime(const char *logfile, const char *dayfile, unsigned t0, unsigned since, int *histok);
+#endif
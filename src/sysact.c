@@ -0,0 +1,209 @@
+#include "sysact.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <syslog.h>
+#ifdef USE_SDBUS
+#include <systemd/sd-bus.h>
+#endif
+
+// system actions are done without a shell, sync() and clock_settime()
+// directly, shut down and reboot through logind on the system bus when
+// built with sd-bus, otherwise the commands are started with posix_spawn()
+// which does not copy the page tables like fork() in system(), the time
+// each action takes is logged
+
+extern char **environ;
+
+// monotonic time in seconds
+static double sysact_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void sysact_log(const char *action, int ok, double t)
+{
+  syslog( ( ok == 1 ) ? LOG_INFO : LOG_ERR, "%s %s in %.1f ms", action, ( ok == 1 ) ? "done" : "failed", 1e3 * ( sysact_now() - t ) );
+}
+
+// start program with arguments and wait for it, stdout goes to fd if
+// it is not negative
+// return: 1=exit status 0, -1=could not start or failed
+static int sysact_spawn(char *const argv[], int fd)
+{
+  pid_t pid;
+  int status;
+  posix_spawn_file_actions_t fa;
+
+  posix_spawn_file_actions_init( &fa );
+  if( fd >= 0 ) posix_spawn_file_actions_adddup2( &fa, fd, STDOUT_FILENO );
+
+  status = posix_spawn( &pid, argv[ 0 ], &fa, NULL, argv, environ );
+  posix_spawn_file_actions_destroy( &fa );
+  if( status != 0 ) return -1;
+
+  if( waitpid( pid, &status, 0 ) < 0 ) return -1;
+
+  return ( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ) ? 1 : -1;
+}
+
+#ifdef USE_SDBUS
+static sd_bus *bus = NULL; // system bus connection opened on first use
+
+static sd_bus *sysact_bus(void)
+{
+  if( bus == NULL && sd_bus_open_system( &bus ) < 0 )
+  {
+    syslog( LOG_NOTICE, "Could not connect to system bus" );
+    bus = NULL;
+  }
+
+  return bus;
+}
+
+// call logind method with the wall message set first if given
+// return: 1=ok, -1=failed
+static int sysact_logind(int action, int mins, const char *msg)
+{
+  sd_bus_error err = SD_BUS_ERROR_NULL;
+  struct timespec ts;
+  uint64_t usec;
+  int r;
+
+  if( sysact_bus() == NULL ) return -1;
+
+  if( msg != NULL ) sd_bus_call_method( bus, "org.freedesktop.login1", "/org/freedesktop/login1", "org.freedesktop.login1.Manager", "SetWallMessage", NULL, NULL, "sb", msg, 1 );
+
+  if( mins > 0 )
+  {
+    clock_gettime( CLOCK_REALTIME, &ts );
+    usec = ( ts.tv_sec + 60 * (uint64_t)mins ) * 1000000 + ts.tv_nsec / 1000;
+    r = sd_bus_call_method( bus, "org.freedesktop.login1", "/org/freedesktop/login1", "org.freedesktop.login1.Manager", "ScheduleShutdown", &err, NULL, "st", ( action == SYSACT_REBOOT ) ? "reboot" : "poweroff", usec );
+  }
+  else r = sd_bus_call_method( bus, "org.freedesktop.login1", "/org/freedesktop/login1", "org.freedesktop.login1.Manager", ( action == SYSACT_REBOOT ) ? "Reboot" : "PowerOff", &err, NULL, "b", 0 );
+
+  if( r < 0 ) syslog( LOG_NOTICE, "logind: %s", err.message ? err.message : strerror( -r ) );
+  sd_bus_error_free( &err );
+
+  return ( r >= 0 ) ? 1 : -1;
+}
+#endif
+
+// flush file system buffers
+// return: 1=ok
+int sysact_sync(void)
+{
+  double t = sysact_now();
+
+  sync();
+  sysact_log( "sync", 1, t );
+
+  return 1;
+}
+
+// power off or reboot after mins minutes, 0=now, with optional message
+// to logged in users
+// return: 1=ok, -1=failed
+int sysact_power(int action, int mins, const char *msg)
+{
+  int ok = -1;
+  double t = sysact_now();
+  char when[ 20 ];
+  char *argv[ 5 ];
+
+#ifdef USE_SDBUS
+  ok = sysact_logind( action, mins, msg );
+#endif
+  if( ok != 1 )
+  {
+    if( mins > 0 ) sprintf( when, "+%d", mins );
+    else strcpy( when, "now" );
+    argv[ 0 ] = "/sbin/shutdown";
+    argv[ 1 ] = ( action == SYSACT_REBOOT ) ? "-r" : "-h";
+    argv[ 2 ] = when;
+    argv[ 3 ] = (char *)msg;
+    argv[ 4 ] = NULL;
+    ok = sysact_spawn( argv, -1 );
+  }
+  sysact_log( ( action == SYSACT_REBOOT ) ? "reboot" : "power off", ok, t );
+
+  return ok;
+}
+
+// set system time directly, this is done at boot before the bus
+// services are up
+// return: 1=ok, -1=failed
+int sysact_settime(const struct timespec *ts)
+{
+  int ok;
+  double t = sysact_now();
+
+  ok = ( clock_settime( CLOCK_REALTIME, ts ) == 0 ) ? 1 : -1;
+  sysact_log( "set time", ok, t );
+
+  return ok;
+}
+
+// send message to logged in users
+// return: 1=ok, -1=failed
+int sysact_wall(const char *msg)
+{
+  int ok;
+  double t = sysact_now();
+  char *argv[ 3 ] = { "/usr/bin/wall", (char *)msg, NULL };
+
+  ok = sysact_spawn( argv, -1 );
+  sysact_log( "wall", ok, t );
+
+  return ok;
+}
+
+// take network interface down
+// return: 1=ok, -1=failed
+int sysact_ifdown(const char *iface)
+{
+  int ok;
+  double t = sysact_now();
+  char *argv[ 3 ] = { "/sbin/ifdown", (char *)iface, NULL };
+
+  ok = sysact_spawn( argv, -1 );
+  sysact_log( "ifdown", ok, t );
+
+  return ok;
+}
+
+// bring network interface up
+// return: 1=ok, -1=failed
+int sysact_ifup(const char *iface)
+{
+  int ok;
+  double t = sysact_now();
+  char *argv[ 3 ] = { "/sbin/ifup", (char *)iface, NULL };
+
+  ok = sysact_spawn( argv, -1 );
+  sysact_log( "ifup", ok, t );
+
+  return ok;
+}
+
+// run executable and wait for it
+// return: 1=ok, -1=failed
+int sysact_run(const char *path)
+{
+  int ok;
+  double t = sysact_now();
+  char *argv[ 2 ] = { (char *)path, NULL };
+
+  ok = sysact_spawn( argv, -1 );
+  sysact_log( path, ok, t );
+
+  return ok;
+}
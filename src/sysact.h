@@ -0,0 +1,13 @@
+#ifndef SYSACT_H_INCLUDED
+#define SYSACT_H_INCLUDED
+#include <time.h>
+#define SYSACT_POWEROFF 1 // halt and power off
+#define SYSACT_REBOOT 2 // reboot
+int sysact_sync(void);
+int sysact_power(int action, int mins, const char *msg);
+int sysact_settime(const struct timespec *ts);
+int sysact_wall(const char *msg);
+int sysact_ifdown(const char *iface);
+int sysact_ifup(const char *iface);
+int sysact_run(const char *path);
+#endif
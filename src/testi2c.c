@@ -11,6 +11,7 @@
 #include "pipichbd.h"
 #include "writecmd.h"
 #include "readdata.h"
+#include "transact.h"
 
 // send 4 test bytes to PiPIC and read them back
 int testi2c()
@@ -27,21 +28,48 @@ int testi2c()
     testint=rand();
   }
 
-  ok=write_cmd(0x02,testint,4);
+  testres=transact(0x02,testint,4,4);
 
-  if(ok!=1) syslog(LOG_ERR, "failed to write 4 test bytes"); 
+  if((testres==-1)||(testres==-2)||(testres==-3)||(testres==-4))
+    syslog(LOG_ERR, "failed to write and read 4 test bytes"); 
   else
   {
-    testres=read_data(4);
-
-    if((testres==-1)||(testres==-2)||(testres==-3)||(testres==-4))
-      syslog(LOG_ERR, "failed to read 4 test bytes"); 
-    else
-    {
-      if(testint==testres) ok=1; else ok=0;
-    }
+    if(testint==testres) ok=1; else ok=0;
   }
 
   return ok;
 }
 
+// test if PiPIC firmware has command 0x07 for reading data memory in one
+// transfer, two bytes are written to tx buffer and the read is started
+// from the second one
+// return: 1=yes, 0=no, negative=i2c failure
+int testbulk()
+{
+  int ok=-1;
+  unsigned char rd=0;
+
+  ok=transact(0x02,0x5AA50000,4,4);
+  if(ok<0) return ok;
+
+  ok=transact_block(0x07,0x58,1,&rd,1);
+  if(ok!=1) return ok;
+
+  return (rd==0xA5);
+}
+
+// test if PiPIC firmware has command 0x44 for summing A/D conversions, old
+// firmware leaves the command byte 0x44 to the place of the maximum and
+// the reply is inconsistent
+// return: 1=yes, 0=no, negative=i2c failure
+int testadcsum()
+{
+  int ok=-1;
+  struct adcsum adc;
+
+  ok=read_adc(0,1,&adc);
+  if(ok==-4) return 0;
+  if(ok!=1) return ok;
+
+  return 1;
+}
@@ -1,4 +1,6 @@
 #ifndef TESTI2C_H_INCLUDED
 #define TESTI2C_H_INCLUDED
 int testi2c();
+int testbulk();
+int testadcsum();
 #endif
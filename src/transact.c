@@ -0,0 +1,82 @@
+#include "transact.h"
+#include <string.h>
+#include <stdio.h>
+#include <syslog.h>
+#include "i2csession.h"
+#include "writecmd.h"
+#include "readdata.h"
+#include "busproto.h"
+
+// send i2c command to PIC with optional data and read the reply in the same
+// locked transaction, length is the number of data bytes 0, 1, 2 or 4 and
+// rlength the number of bytes to read 1, 2 or 4
+// return: reply or -1=open failed, -2=lock failed, -3=bus access failed,
+// -4=i2c slave writing or reading failed
+int transact(int cmd, int data, int length, int rlength)
+{
+  int ok = 0;
+  int n = 0;
+  unsigned char wbuf[ 10 ];
+  unsigned char rbuf[ 10 ];
+
+  if( cmd < 0 || cmd > 255 ) return ok;
+  if( rlength != 1 && rlength != 2 && rlength != 4 ) return ok;
+
+  n = cmd_bytes( wbuf, cmd, data, length );
+
+  ok = i2c_session_xfer( &i2cses, wbuf, n, rbuf, rlength );
+  if( ok != 1 ) return ok;
+
+  return data_value( rbuf, rlength );
+}
+
+
+// send the same command n times and read each reply while the i2c port is
+// kept locked, the replies are stored to values
+// return: number of replies read or error from the first transfer
+int transact_repeat(int cmd, int data, int length, int rlength, int *values, int n)
+{
+  int ok = 0;
+  int i;
+  int wn = 0;
+  unsigned char wbuf[ 10 ];
+  unsigned char rbuf[ 10 ];
+
+  if( cmd < 0 || cmd > 255 ) return ok;
+  if( rlength != 1 && rlength != 2 && rlength != 4 ) return ok;
+  if( n < 1 ) return ok;
+
+  wn = cmd_bytes( wbuf, cmd, data, length );
+
+  ok = i2c_session_lock( &i2cses );
+  if( ok != 1 ) return ok;
+
+  for( i = 0; i < n; i++ )
+  {
+    ok = i2c_session_xfer( &i2cses, wbuf, wn, rbuf, rlength );
+    if( ok != 1 ) break;
+    values[ i ] = data_value( rbuf, rlength );
+  }
+
+  i2c_session_unlock( &i2cses );
+
+  if( i == 0 ) return ok;
+
+  return i;
+}
+
+// send i2c command to PIC and read a block of rlength bytes in the same
+// locked transaction, used with command 0x07 to read data memory
+// return: 1=ok, 0=bad length, otherwise error from i2c_session_xfer()
+int transact_block(int cmd, int data, int length, unsigned char *rbuf, int rlength)
+{
+  int n = 0;
+  unsigned char wbuf[ 10 ];
+
+  if( cmd < 0 || cmd > 255 ) return 0;
+  if( rlength < 1 || rlength > BUSMAXDATA ) return 0;
+
+  n = cmd_bytes( wbuf, cmd, data, length );
+
+  return i2c_session_xfer( &i2cses, wbuf, n, rbuf, rlength );
+}
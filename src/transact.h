@@ -0,0 +1,6 @@
+#ifndef TRANSACT_H_INCLUDED
+#define TRANSACT_H_INCLUDED
+int transact(int cmd, int data, int length, int rlength);
+int transact_repeat(int cmd, int data, int length, int rlength, int *values, int n);
+int transact_block(int cmd, int data, int length, unsigned char *rbuf, int rlength);
+#endif
@@ -1,5 +1,6 @@
 #ifndef WRITECMD_H_INCLUDED
 #define WRITECMD_H_INCLUDED
+int cmd_bytes(unsigned char *buf, int cmd, int data, int length);
 int write_cmd(int cmd, int data, int length);
 #endif
 